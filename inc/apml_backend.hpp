@@ -0,0 +1,231 @@
+#pragma once
+
+extern "C" {
+#include "apml.h"
+#include "esmi_cpuid_msr.h"
+}
+
+#include <gpiod.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define APML_TRACE_HEADER  "# cpu-info apml trace v1"
+
+// libapml calls made by the collection and the telemetry sampler
+enum ApmlCall
+{
+    APML_CPUID,
+    APML_CPUID_EAX,
+    APML_CPUID_EBX,
+    APML_CPUID_ECX,
+    APML_CPUID_EDX,
+    APML_THREADS_PER_SOCKET,
+    APML_THREADS_PER_CORE,
+    APML_READ_MAILBOX,
+    APML_RMI_REVISION,
+    APML_SOCKET_POWER,
+    APML_SOCKET_POWER_LIMIT,
+    APML_BOOST_LIMIT,
+    APML_CPU_TEMP,
+    APML_PRESENT_GPIO,
+    APML_READ_MSR,
+    APML_CALL_COUNT
+};
+
+#define APML_MAX_SOCKETS   (16)
+
+// Presence line of a socket, looked up and requested on its first read
+// and kept by the collector that owns it, the lookup allocates
+struct PresentGpio
+{
+    std::string name;
+    gpiod::line line;
+    bool requested = false;
+};
+
+// CPUID register read on its own, APML_CPUID_EAX to APML_CPUID_EDX
+using ApmlCpuidReg = ApmlCall;
+
+// libapml as seen by the collector, one implementation talks to the
+// CPUs, the others record or replay the calls of a collection
+class ApmlBackend
+{
+  public:
+    virtual ~ApmlBackend()
+    {
+    }
+
+    // CPUID leaf *eax, subleaf *ecx, all four registers out
+    virtual oob_status_t cpuid(uint8_t soc_num, uint32_t thread, uint32_t *eax, uint32_t *ebx,
+                               uint32_t *ecx, uint32_t *edx) = 0;
+    virtual oob_status_t cpuid_reg(ApmlCpuidReg reg, uint8_t soc_num, uint32_t thread,
+                                   uint32_t fn, uint32_t extd_fn, uint32_t *value) = 0;
+    virtual oob_status_t threads_per_socket(uint8_t soc_num, uint32_t *value) = 0;
+    virtual oob_status_t threads_per_core(uint8_t soc_num, uint32_t *value) = 0;
+    virtual oob_status_t read_mailbox(uint8_t soc_num, uint32_t cmd, uint32_t arg,
+                                      uint32_t *value) = 0;
+    virtual oob_status_t rmi_revision(uint8_t soc_num, uint8_t *rev) = 0;
+    // telemetry, power in mW, boost limit in MHz, SB-TSI temperature in degC
+    virtual oob_status_t socket_power(uint8_t soc_num, uint32_t *mw) = 0;
+    virtual oob_status_t socket_power_limit(uint8_t soc_num, uint32_t *mw) = 0;
+    virtual oob_status_t boost_limit(uint8_t soc_num, uint32_t cpu, uint32_t *mhz) = 0;
+    virtual oob_status_t cpu_temp(uint8_t soc_num, float *temp) = 0;
+    // not APML, but read by the collection with it: the presence line of
+    // the socket, *value is 1 when the socket is empty
+    virtual oob_status_t present_gpio(uint8_t soc_num, PresentGpio& gpio, int *value) = 0;
+    // MSR of one thread, for the core enumeration
+    virtual oob_status_t read_msr(uint8_t soc_num, uint32_t thread, uint32_t msr,
+                                  uint64_t *value) = 0;
+
+    // wait between retries, a replay scales it with the call timing
+    virtual void pause(unsigned int usec);
+};
+
+// Calls straight into libapml
+class LibApmlBackend : public ApmlBackend
+{
+  public:
+    oob_status_t cpuid(uint8_t soc_num, uint32_t thread, uint32_t *eax, uint32_t *ebx,
+                       uint32_t *ecx, uint32_t *edx) override;
+    oob_status_t cpuid_reg(ApmlCpuidReg reg, uint8_t soc_num, uint32_t thread,
+                           uint32_t fn, uint32_t extd_fn, uint32_t *value) override;
+    oob_status_t threads_per_socket(uint8_t soc_num, uint32_t *value) override;
+    oob_status_t threads_per_core(uint8_t soc_num, uint32_t *value) override;
+    oob_status_t read_mailbox(uint8_t soc_num, uint32_t cmd, uint32_t arg,
+                              uint32_t *value) override;
+    oob_status_t rmi_revision(uint8_t soc_num, uint8_t *rev) override;
+    oob_status_t socket_power(uint8_t soc_num, uint32_t *mw) override;
+    oob_status_t socket_power_limit(uint8_t soc_num, uint32_t *mw) override;
+    oob_status_t boost_limit(uint8_t soc_num, uint32_t cpu, uint32_t *mhz) override;
+    oob_status_t cpu_temp(uint8_t soc_num, float *temp) override;
+    oob_status_t present_gpio(uint8_t soc_num, PresentGpio& gpio, int *value) override;
+    oob_status_t read_msr(uint8_t soc_num, uint32_t thread, uint32_t msr,
+                          uint64_t *value) override;
+};
+
+// process wide libapml backend, the default of every collector
+ApmlBackend& libapml_backend();
+
+// One call of a trace: inputs, status, outputs and when it ran
+struct ApmlTraceRecord
+{
+    ApmlCall call;
+    uint8_t soc_num;
+    uint32_t args[3];
+    int status;
+    uint32_t out[4];
+    uint64_t start_usec;
+    uint64_t dur_usec;
+};
+
+// Passes every call to another backend and appends it to a trace file,
+// one text line per call
+class RecordingBackend : public ApmlBackend
+{
+  public:
+    RecordingBackend(ApmlBackend &target, const char *path);
+    ~RecordingBackend();
+
+    bool is_open() const
+    {
+        return file != nullptr;
+    }
+
+    oob_status_t cpuid(uint8_t soc_num, uint32_t thread, uint32_t *eax, uint32_t *ebx,
+                       uint32_t *ecx, uint32_t *edx) override;
+    oob_status_t cpuid_reg(ApmlCpuidReg reg, uint8_t soc_num, uint32_t thread,
+                           uint32_t fn, uint32_t extd_fn, uint32_t *value) override;
+    oob_status_t threads_per_socket(uint8_t soc_num, uint32_t *value) override;
+    oob_status_t threads_per_core(uint8_t soc_num, uint32_t *value) override;
+    oob_status_t read_mailbox(uint8_t soc_num, uint32_t cmd, uint32_t arg,
+                              uint32_t *value) override;
+    oob_status_t rmi_revision(uint8_t soc_num, uint8_t *rev) override;
+    oob_status_t socket_power(uint8_t soc_num, uint32_t *mw) override;
+    oob_status_t socket_power_limit(uint8_t soc_num, uint32_t *mw) override;
+    oob_status_t boost_limit(uint8_t soc_num, uint32_t cpu, uint32_t *mhz) override;
+    oob_status_t cpu_temp(uint8_t soc_num, float *temp) override;
+    oob_status_t present_gpio(uint8_t soc_num, PresentGpio& gpio, int *value) override;
+    oob_status_t read_msr(uint8_t soc_num, uint32_t thread, uint32_t msr,
+                          uint64_t *value) override;
+    void pause(unsigned int usec) override;
+
+  private:
+    uint64_t now_usec() const;
+    void write(const ApmlTraceRecord& record);
+    // single output value calls
+    template <typename Call>
+    oob_status_t record_call(ApmlCall call, uint8_t soc_num, uint32_t a0, uint32_t a1,
+                             uint32_t *out, Call&& fn);
+
+    ApmlBackend &target;
+    FILE *file = nullptr;
+    uint64_t origin_usec;
+    std::mutex lock;
+};
+
+// Answers from a recorded trace. Calls with the same inputs get the
+// recorded answers in order, the last one repeats once they run out.
+// time_scale stretches the recorded call durations, the gaps between
+// calls and the pauses, 0 runs without waiting.
+class ReplayBackend : public ApmlBackend
+{
+  public:
+    ReplayBackend(const char *path, double time_scale = 1.0);
+
+    bool is_open() const
+    {
+        return loaded;
+    }
+
+    oob_status_t cpuid(uint8_t soc_num, uint32_t thread, uint32_t *eax, uint32_t *ebx,
+                       uint32_t *ecx, uint32_t *edx) override;
+    oob_status_t cpuid_reg(ApmlCpuidReg reg, uint8_t soc_num, uint32_t thread,
+                           uint32_t fn, uint32_t extd_fn, uint32_t *value) override;
+    oob_status_t threads_per_socket(uint8_t soc_num, uint32_t *value) override;
+    oob_status_t threads_per_core(uint8_t soc_num, uint32_t *value) override;
+    oob_status_t read_mailbox(uint8_t soc_num, uint32_t cmd, uint32_t arg,
+                              uint32_t *value) override;
+    oob_status_t rmi_revision(uint8_t soc_num, uint8_t *rev) override;
+    oob_status_t socket_power(uint8_t soc_num, uint32_t *mw) override;
+    oob_status_t socket_power_limit(uint8_t soc_num, uint32_t *mw) override;
+    oob_status_t boost_limit(uint8_t soc_num, uint32_t cpu, uint32_t *mhz) override;
+    oob_status_t cpu_temp(uint8_t soc_num, float *temp) override;
+    oob_status_t present_gpio(uint8_t soc_num, PresentGpio& gpio, int *value) override;
+    oob_status_t read_msr(uint8_t soc_num, uint32_t thread, uint32_t msr,
+                          uint64_t *value) override;
+    void pause(unsigned int usec) override;
+
+  private:
+    using Key = std::tuple<int, uint8_t, uint32_t, uint32_t, uint32_t>;
+    struct Answers
+    {
+        std::vector<ApmlTraceRecord> records;
+        size_t next = 0;
+    };
+
+    oob_status_t replay(ApmlCall call, uint8_t soc_num, uint32_t a0, uint32_t a1, uint32_t a2,
+                        uint32_t *out);
+    std::chrono::microseconds scaled(uint64_t usec) const;
+
+    // recorded end of the previous replayed call of a socket and when it
+    // ended here, sockets are collected in parallel
+    struct Pacing
+    {
+        bool replayed = false;
+        uint64_t end_usec = 0;
+        std::chrono::steady_clock::time_point end;
+    };
+
+    std::map<Key, Answers> answers;
+    double time_scale;
+    bool loaded = false;
+    std::mutex lock;
+    Pacing pacing[APML_MAX_SOCKETS];
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#define APML_CAPS_DIR    "/var/lib/cpu-info"
+#define APML_CAPS_PATH   APML_CAPS_DIR "/apml-capabilities"
+// the signature misses SMU firmware and microcode updates, unsupported
+// commands are tried again once a week in case an update added them
+#define APML_CAPS_REPROBE_SEC   (7 * 24 * 60 * 60)
+
+// Mailbox commands whose support depends on CPU family and firmware
+enum ApmlCommand
+{
+    CAP_BASE_FREQ,
+    CAP_PPIN,
+    CAP_UCODE,
+    CAP_COUNT
+};
+
+enum ApmlSupport : char
+{
+    CAP_UNKNOWN = '?',
+    CAP_SUPPORTED = 's',
+    CAP_UNSUPPORTED = 'u',
+};
+
+// CPUID Fn0000_0001 EAX carries family, model and stepping, the SB-RMI
+// revision stands in for the APML firmware
+struct CapSignature
+{
+    uint32_t cpuid_eax;
+    uint8_t rmi_rev;
+
+    bool operator<(const CapSignature& other) const
+    {
+        return std::tie(cpuid_eax, rmi_rev) < std::tie(other.cpuid_eax, other.rmi_rev);
+    }
+};
+
+// Persistent support matrix, learnt from the answers of the first
+// collection on every signature and shared by all collectors
+class ApmlCapabilities
+{
+  public:
+    explicit ApmlCapabilities(const char *path = APML_CAPS_PATH);
+
+    ApmlSupport lookup(const CapSignature& sig, ApmlCommand cmd) const;
+    // record the first definite answer, the file is rewritten on change
+    void record(const CapSignature& sig, ApmlCommand cmd, ApmlSupport support);
+
+  private:
+    struct CapEntry
+    {
+        std::array<char, CAP_COUNT> support;
+        // wall clock of the last unsupported answer, persisted
+        int64_t probed;
+    };
+
+    void load();
+    void save();
+    static bool expired(const CapEntry& entry);
+
+    std::string path;
+    std::map<CapSignature, CapEntry> entries;
+    mutable std::mutex lock;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "worker_pool.hpp"
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/vtable.hpp>
+
+#include <chrono>
+#include <cstdint>
+
+#define SERVICE_STATS_INTF   "xyz.openbmc_project.Inventory.Item.Cpu.ServiceStats"
+// time-to-inventory samples the percentiles are taken over
+#define STATS_SAMPLES        (128)
+
+// Load figures of the service, served on DBUS_OBJECT_NAME so a power
+// cycle storm can be measured from outside without extra logging.
+// Event loop thread only.
+class CollectionStats
+{
+  public:
+    explicit CollectionStats(sdbusplus::bus::bus &bus);
+
+    // CurrentHostState left Off, start of a time-to-inventory sample
+    void host_signal();
+    void collection_started();
+    // trigger folded into a collection already in flight
+    void coalesced();
+    void set_issued();
+    void set_failed();
+    // every Set of the collection was answered
+    void inventory_done(std::chrono::steady_clock::duration elapsed);
+    // report the queue figures of the APML worker pool
+    void watch_pool(WorkerPool *worker_pool)
+    {
+        pool = worker_pool;
+    }
+
+  private:
+    static int get_property(sd_bus *bus, const char *path, const char *interface,
+                            const char *property, sd_bus_message *reply,
+                            void *userdata, sd_bus_error *error);
+#ifdef ENABLE_TESTS
+    static int reset(sd_bus_message *msg, void *userdata, sd_bus_error *error);
+#endif
+    static const sd_bus_vtable vtable[];
+
+    uint64_t percentile(unsigned int pct) const;
+
+    uint64_t host_signals = 0;
+    uint64_t collections = 0;
+    uint64_t coalesced_triggers = 0;
+    uint64_t sets_issued = 0;
+    uint64_t sets_failed = 0;
+    uint64_t samples = 0;
+    uint64_t inventory_usec[STATS_SAMPLES] = {};
+    WorkerPool *pool = nullptr;
+    sdbusplus::server::interface_t intf;
+};
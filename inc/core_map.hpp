@@ -0,0 +1,38 @@
+#pragma once
+
+#include "apml_backend.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#define CORE_MAP_INTF             "xyz.openbmc_project.Inventory.Item.Cpu.CoreMap"
+#define CORE_MAP_DISABLED         (0xFFFFFFFF)
+// total APML bus time one socket's enumeration may use
+#define CORE_MAP_BUS_BUDGET_USEC  (20 * 1000 * 1000)
+// nice value of the background enumeration thread
+#define CORE_MAP_NICE             (19)
+
+// Compact per socket core map. Threads are in APML thread index order,
+// the first threads_per_socket / threads_per_core entries are the primary
+// thread of each core, the SMT siblings follow.
+struct CoreMap
+{
+    uint8_t soc_num = 0;
+    uint32_t threads_per_core = 0;
+    // per thread extended APIC ID, CORE_MAP_DISABLED if the thread is off
+    std::vector<uint32_t> apic_ids;
+    // per core microcode patch level, CORE_MAP_DISABLED if not readable
+    std::vector<uint32_t> core_ucode;
+    uint32_t enabled_cores = 0;
+    bool ucode_consistent = true;
+    // all threads read within the bus budget
+    bool complete = false;
+    uint64_t bus_usec = 0;
+};
+
+// Walk every core and thread of processor P<soc_num>, libapml socket
+// apml_socket, through apml. Reads one full CPUID leaf per thread and one
+// MSR per core, primary threads first so the core enable map is known
+// early, and stops once budget_usec of bus time is used.
+bool enumerate_cores(ApmlBackend& apml, uint8_t soc_num, uint8_t apml_socket,
+                     uint64_t budget_usec, CoreMap& map);
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "apml_backend.hpp"
+#include "apml_caps.hpp"
+#include "host_config.hpp"
+
+extern "C" {
+#include "esmi_cpuid_msr.h"
+}
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#define CPUID_Fn8000002       (0x80000002)
+#define CPUID_Fn8000003       (0x80000003)
+#define CPUID_Fn8000004       (0x80000004)
+
+#define PARTNUMBER   "PartNumber"
+#define SUMMARY_LEN  (256)
+// longest string property, the OPN is 48 characters
+#define PROP_STR_LEN (64)
+// properties one host stages per collection, reserved up front
+#define MAX_PENDING_PROPS  (MAX_SOCKETS_PER_HOST * 16)
+
+enum dbus_interface { CPU_INTERFACE, ASSET_INTERFACE } ;
+
+// String property value held in place, staging never touches the heap
+struct PropertyString
+{
+    char str[PROP_STR_LEN];
+};
+
+using PropertyValue = std::variant<PropertyString, uint32_t, uint16_t, bool>;
+
+// Property collected on a worker thread, published from the event loop.
+// name points at a string literal, property names are never copied.
+struct PendingProperty
+{
+    uint8_t soc_num;
+    uint8_t enum_val;
+    const char *name;
+    PropertyValue value;
+};
+
+// Wall time spent in one collection step of one socket
+struct StepTiming
+{
+    uint8_t soc_num;
+    const char *step;
+    uint64_t usec;
+};
+
+// Steps that lazy mode leaves out of the collection, slow and rarely read
+enum LazyStep
+{
+    LAZY_PPIN,      // PPIN and SerialNumber, mailbox with up to 20 retries
+    LAZY_OPN,       // PartNumber, 12 CPUID reads
+    LAZY_STEP_COUNT
+};
+
+// Failed steps of one socket in one collection
+struct CollectSummary
+{
+    unsigned int failures;
+    char failed_steps[SUMMARY_LEN];
+
+    void failed(const char *step);
+};
+
+// APML side of the service. Reads the CPU information of one host over
+// libapml and stages it as properties, without any D-Bus dependency.
+class CpuCollector
+{
+  public:
+    // soc_num arguments are the <n> of processor P<n>, config maps them
+    // to the host's libapml sockets and presence lines
+    explicit CpuCollector(uint8_t host_num = 0) :
+        CpuCollector(host_num, default_host_config(host_num))
+    {
+    }
+    CpuCollector(uint8_t host_num, const HostConfig& config) :
+        host_num(host_num), config(config), num_of_proc(config.num_of_cpu)
+    {
+        pending.reserve(MAX_PENDING_PROPS);
+        timings.reserve(MAX_PENDING_PROPS);
+        present.reserve(MAX_SOCKETS_PER_HOST);
+        for (uint8_t i = 0; i < MAX_SOCKETS_PER_HOST; i++)
+        {
+            present_gpios[i].name = config.present_gpios[i];
+        }
+    }
+    virtual ~CpuCollector()
+    {
+    }
+
+    // read all fields of one socket into pending, with per step timings
+    void collect_socket(uint8_t soc_num);
+
+    // read one step skipped in lazy mode into pending, false on errors
+    bool collect_lazy(uint8_t soc_num, LazyStep step);
+
+    // shared support matrix, commands it marks unsupported are skipped
+    void set_capabilities(ApmlCapabilities *capabilities)
+    {
+        caps = capabilities;
+    }
+
+    // libapml calls go through apml, a recorder or a replayed trace
+    void set_backend(ApmlBackend *backend)
+    {
+        apml = backend;
+    }
+
+    // skip the LazyStep steps in collect_socket
+    bool lazy = false;
+
+    std::vector<PendingProperty> pending;
+    std::vector<StepTiming> timings;
+    // sockets that answered over APML in the last collection
+    std::vector<uint8_t> present;
+    // sockets the last collection tried, from the first socket of the host
+    uint8_t collected = 0;
+
+  protected:
+    // called on the collecting thread before each step of a socket
+    virtual void on_step(uint8_t soc_num, const char *step)
+    {
+    }
+
+    uint8_t host_num;
+    const HostConfig config;
+    uint8_t num_of_proc;
+    ApmlCapabilities *caps = nullptr;
+    ApmlBackend *apml = &libapml_backend();
+    unsigned int step_errors = 0;
+    // signature of each socket of the host, from the last leaf 1 read
+    CapSignature signatures[MAX_SOCKETS_PER_HOST] = {};
+    // presence line of each socket, read through apml so that it is
+    // recorded and replayed with the collection
+    PresentGpio present_gpios[MAX_SOCKETS_PER_HOST];
+
+    // oob-lib functions
+    void collect_cpu_information();
+    int  getGPIOValue(uint8_t soc_num);
+    uint8_t get_first_socket() const { return config.inventory_base; }
+    // socket of the host, 0 up to MAX_SOCKETS_PER_HOST - 1, for P<soc_num>
+    uint8_t socket_index(uint8_t soc_num) const { return soc_num - config.inventory_base; }
+    // libapml index of P<soc_num>
+    uint8_t apml_socket(uint8_t soc_num) const { return config.apml_base + socket_index(soc_num); }
+    void set_general_info(uint8_t soc_num);
+    bool connect_apml_get_family_model_step(uint8_t soc_num);
+    void get_threads_per_core_and_soc(uint8_t soc_num);
+    void get_cpu_base_freq(uint8_t soc_num);
+    void get_ppin_fuse(uint8_t soc_num);
+    void get_microcode_rev(uint8_t soc_num);
+
+    void collect_error(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    void log_summary(uint8_t soc_num, bool answered, size_t fields, const CollectSummary& summary,
+                     size_t first_timing, uint64_t usec);
+
+    bool cmd_supported(uint8_t soc_num, ApmlCommand cmd);
+    void cmd_result(uint8_t soc_num, ApmlCommand cmd, oob_status_t ret);
+
+    //property staging functions
+    void set_cpu_property(uint8_t soc_num, const char *property_name, uint8_t enum_val, const PropertyValue& value);
+    void set_cpu_string_value(uint8_t soc_num, std::string_view value, const char *property_name, uint8_t enum_val);
+    void set_cpu_int_value(uint8_t soc_num, uint32_t value, const char *property_name, uint8_t enum_val);
+    void set_cpu_int16_value(uint8_t soc_num, uint16_t value, const char *property_name, uint8_t enum_val);
+    void set_cpu_bool_value(uint8_t soc_num, bool value, const char *property_name, uint8_t enum_val);
+
+    //decode ppin function
+    void decode_PPIN(uint8_t soc_num, uint64_t data);
+
+    //OPN functions
+    void get_opn(uint8_t soc_num);
+    bool read_register(uint8_t soc_num, uint32_t thread_ind, uint32_t cpuid_fn, uint32_t cpuid_extd_fn, uint32_t *eax_value, uint32_t *ebx_value, uint32_t *ecx_value, uint32_t *edx_value);
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Pure decoders for the values read over APML. Nothing here touches the
+// bus or D-Bus, so the same code serves the daemon and offline tooling.
+
+#define OPN_LEAF_COUNT        (3)
+#define OPN_REG_COUNT         (4)
+#define OPN_BUFF_LEN          (OPN_LEAF_COUNT * OPN_REG_COUNT * 4 + 1)
+#define LOTNUM_LENGTH         (7)
+#define SERIAL_NUM_LEN        (16)
+
+// Marked lot number, bits 21-57 of the PPIN, lotstr holds LOTNUM_LENGTH + 1
+void decode_lotstring(uint64_t ppin, char* lotstr);
+
+// Marking month, last digit of marking year and unit # in lot
+void decode_datemonth_unitlot(uint64_t ppin, char* buf, size_t len);
+
+// Serial number = lot string + month + year + dev number
+void decode_ppin_serial(uint64_t ppin, char* buf, size_t len);
+
+// OPN string from CPUID Fn8000_0002..4 eax/ebx/ecx/edx, opn holds OPN_BUFF_LEN
+void decode_opn(const uint32_t regs[OPN_LEAF_COUNT][OPN_REG_COUNT], char* opn);
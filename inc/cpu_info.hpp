@@ -1,31 +1,38 @@
 #include <fcntl.h>
 #include <unistd.h>
-#include <fstream>
-#include <iostream>
-#include <sstream>
 #include <map>
-#include<iomanip>
+#include <vector>
+#include "core_map.hpp"
+#include "cpu_collector.hpp"
+#include "collection_stats.hpp"
+#include "cpu_info_shm_writer.hpp"
+#include "inventory_events.hpp"
+#include "service_notify.hpp"
+#include "telemetry.hpp"
+#include "worker_pool.hpp"
 #include <phosphor-logging/elog-errors.hpp>
 #include <xyz/openbmc_project/Collection/DeleteAll/server.hpp>
 #include <xyz/openbmc_project/Common/error.hpp>
 #include <xyz/openbmc_project/State/Host/server.hpp>
 #include <xyz/openbmc_project/Inventory/Item/Cpu/server.hpp>
 #include <xyz/openbmc_project/Inventory/Item/server.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/vtable.hpp>
 
-#define CPUID_Fn8000002       (0x80000002)
-#define CPUID_Fn8000003       (0x80000003)
-#define CPUID_Fn8000004       (0x80000004)
+#define INVENTORY_MANAGER     "xyz.openbmc_project.Inventory.Manager"
 
-#define MASK_BYTE_2           (0xFF00)
-#define MASK_BYTE_3           (0xFF0000)
-#define MASK_BYTE_4           (0xFF000000)
-#define MASK_TWO_BYTES        (0xFF)
-
-#define SHIFT_24              (24)
-#define SHIFT_16              (16)
-#define SHIFT_8               (8)
-#define OPN_LENGTH            (47)
-#define PARTNUMBER   "PartNumber"
+// Collection waits for host firmware to report boot progress, then for
+// APML to answer a probe. A host that sends no progress within the wait
+// is collected as soon as it is on, and so are its later boots.
+#define BOOT_PROGRESS_INTF      "xyz.openbmc_project.State.Boot.Progress"
+#define BOOT_RAW_INTF           "xyz.openbmc_project.State.Boot.Raw"
+#define BOOT_RAW_PATH_PREFIX    "/xyz/openbmc_project/state/boot/raw"
+#define BOOT_PROGRESS_WAIT_SEC  (60)
+#define BOOT_PROBE_INTERVAL_MS  (1000)
+// probe failures past this leave the retries to the collection itself
+#define BOOT_PROBE_TIMEOUT_SEC  (300)
+// host state service not up at startup, read CurrentHostState again
+#define HOST_STATE_RETRY_SEC    (5)
 
 const static constexpr char *CpuInfoName =
     "CpuInfo";
@@ -34,23 +41,11 @@ const static constexpr char *CpuInfoEnableName =
 
 class CpuInfoDataHolder
 {
-    static CpuInfoDataHolder *instance;
-    CpuInfoDataHolder()
-    {
-    }
-
   public:
-    static CpuInfoDataHolder *getInstance()
-    {
-        if (!instance)
-            instance = new CpuInfoDataHolder;
-        return instance;
-    }
-
     const static constexpr char *PropertiesIntf =
         "org.freedesktop.DBus.Properties";
     const static constexpr char *HostStatePathPrefix =
-        "/xyz/openbmc_project/state/host0";
+        "/xyz/openbmc_project/state/host";
 };
 
 struct EventDeleter
@@ -64,26 +59,96 @@ struct EventDeleter
 using EventPtr = std::unique_ptr<sd_event, EventDeleter>;
 namespace StateServer = sdbusplus::xyz::openbmc_project::State::server;
 
-enum dbus_interface { CPU_INTERFACE, ASSET_INTERFACE } ;
 static const char *enum_str[] = { "xyz.openbmc_project.Inventory.Item.Cpu", "xyz.openbmc_project.Inventory.Decorator.Asset" };
-static const std::map<int, std::string> months_map = {{1,"M"}, {2,"N"}, {3,"O"}, {4,"P"}, {5,"Q"}, {6,"R"}, {7,"S"}, {8,"T"}, {9,"U"}, {10,"V"}, {11,"W"}, {12,"X"}};
 
-struct CpuInfo
+// CoreMap of one socket, served by this service under DBUS_OBJECT_NAME/P<n>
+class CoreMapObject
 {
-    CpuInfoDataHolder *cpuinfoDataHolderObj =
-        cpuinfoDataHolderObj->getInstance();
+  public:
+    CoreMapObject(sdbusplus::bus::bus &bus, uint8_t soc_num);
+    void update(CoreMap&& new_map);
+
+  private:
+    static int get_property(sd_bus *bus, const char *path, const char *interface,
+                            const char *property, sd_bus_message *reply,
+                            void *userdata, sd_bus_error *error);
+    static const sd_bus_vtable vtable[];
+
+    std::string path;
+    CoreMap map;
+    sdbusplus::server::interface_t intf;
+};
+
+#define LAZY_FIELDS_INTF  "xyz.openbmc_project.Inventory.Item.Cpu.LazyFields"
+#define LAZY_UNAVAILABLE  "xyz.openbmc_project.Common.Error.Unavailable"
+
+struct CpuInfo;
 
-    CpuInfo(sdbusplus::bus::bus &bus, const char *path, EventPtr &event) :
-        bus(bus),
+// Fields left out of the collection in lazy mode, served by this service
+// under DBUS_OBJECT_NAME/P<n>. The first read of a field or a Fetch call
+// reads it over APML, the value is also published to the Inventory Manager.
+class LazyFieldsObject
+{
+  public:
+    LazyFieldsObject(sdbusplus::bus::bus &bus, uint8_t soc_num, CpuInfo &owner);
+    // the fields of step were read again or went stale
+    void changed(LazyStep step);
+
+  private:
+    static int get_property(sd_bus *bus, const char *path, const char *interface,
+                            const char *property, sd_bus_message *reply,
+                            void *userdata, sd_bus_error *error);
+    static int fetch(sd_bus_message *msg, void *userdata, sd_bus_error *error);
+    static const sd_bus_vtable vtable[];
+
+    uint8_t soc_num;
+    CpuInfo &owner;
+    std::string path;
+    sdbusplus::server::interface_t intf;
+};
+
+// Process wide pieces shared by the CpuInfo of every host
+struct CpuInfoServices
+{
+    WorkerPool &pool;
+    CpuShmWriter &snapshot;
+    // low priority core enumeration, nullptr when disabled
+    WorkerPool *background = nullptr;
+    // socket telemetry sampling, nullptr when disabled
+    TelemetrySampler *telemetry = nullptr;
+    // systemd readiness and watchdog, nullptr when not run by systemd
+    ServiceNotifier *notifier = nullptr;
+    // APML command support matrix
+    ApmlCapabilities *caps = nullptr;
+    // identity change signal, nullptr when not served
+    InventoryEvents *events = nullptr;
+    // load figures, nullptr when not served
+    CollectionStats *stats = nullptr;
+    // boot progress and probe timers, collection starts on host on without it
+    sd_event *event = nullptr;
+    // libapml, or a recorder or replay of it
+    ApmlBackend *apml = &libapml_backend();
+};
+
+struct CpuInfo : public CpuCollector
+{
+    // host_num selects host<N> state, config its sockets and inventory
+    // objects, all hosts share one bus and the services
+    CpuInfo(sdbusplus::bus::bus &bus, uint8_t host_num, const HostConfig &config,
+            const CpuInfoServices &services) :
+        CpuCollector(host_num, config), bus(bus), pool(services.pool), snapshot(services.snapshot),
+        background(services.background), telemetry(services.telemetry),
+        notifier(services.notifier), events(services.events), stats(services.stats),
+        event(services.event),
         propertiesChangedCpuInfoValue(
             bus,
             sdbusplus::bus::match::rules::type::signal() +
                 sdbusplus::bus::match::rules::member("PropertiesChanged") +
                 sdbusplus::bus::match::rules::path(
-                "/xyz/openbmc_project/inventory/system/processor/P0") +
+                    config.inventory_prefix + std::to_string(config.inventory_base)) +
                 sdbusplus::bus::match::rules::argN(0, "xyz.openbmc_project.Inventory.Item.Cpu") +
                 sdbusplus::bus::match::rules::interface(
-                    cpuinfoDataHolderObj->PropertiesIntf),
+                    CpuInfoDataHolder::PropertiesIntf),
             [this](sdbusplus::message::message &msg) {
                 std::string objectName;
                 std::map<std::string, std::variant<uint32_t,bool>> msgData;
@@ -95,9 +160,9 @@ struct CpuInfo
             sdbusplus::bus::match::rules::type::signal() +
                 sdbusplus::bus::match::rules::member("PropertiesChanged") +
                 sdbusplus::bus::match::rules::path(
-                    cpuinfoDataHolderObj->HostStatePathPrefix)  +
+                    CpuInfoDataHolder::HostStatePathPrefix + std::to_string(host_num))  +
                 sdbusplus::bus::match::rules::interface(
-                    cpuinfoDataHolderObj->PropertiesIntf),
+                    CpuInfoDataHolder::PropertiesIntf),
             [this](sdbusplus::message::message &msg) {
                 std::string objectName;
                 std::map<std::string, std::variant<std::string>> msgData;
@@ -107,62 +172,192 @@ struct CpuInfo
                 {
                     if (valPropMap != msgData.end())
                     {
+                        host_state_known = true;
                         StateServer::Host::HostState currentHostState =
                             StateServer::Host::convertHostStateFromString(
                                 std::get<std::string>(valPropMap->second));
 
                         if (currentHostState != StateServer::Host::HostState::Off)
                         {
-                            sd_journal_print(LOG_INFO, "cpu service started after bmc or host reboot... \n");
-                            if (getNumberOfCpu())
+                            if (stats)
+                            {
+                                stats->host_signal();
+                            }
+                            sd_journal_print(LOG_INFO, "host%d cpu service started after bmc or host reboot... \n", this->host_num);
+                            boot_host_on();
+                        }
+                        else
+                        {
+                            boot_host_off();
+                            stop_telemetry();
+                            lazy_host_off();
+                            if (notifier)
                             {
-                               collect_cpu_information();
+                                notifier->host_ready(this->host_num, "host off");
                             }
                         }
                     }
                 }
-        })
+        }),
+        propertiesChangedBootProgress(
+            bus,
+            sdbusplus::bus::match::rules::type::signal() +
+                sdbusplus::bus::match::rules::member("PropertiesChanged") +
+                sdbusplus::bus::match::rules::path(
+                    CpuInfoDataHolder::HostStatePathPrefix + std::to_string(host_num)) +
+                sdbusplus::bus::match::rules::argN(0, BOOT_PROGRESS_INTF) +
+                sdbusplus::bus::match::rules::interface(
+                    CpuInfoDataHolder::PropertiesIntf),
+            [this](sdbusplus::message::message &msg) {
+                on_boot_progress(msg);
+            }),
+        propertiesChangedPostCode(
+            bus,
+            sdbusplus::bus::match::rules::type::signal() +
+                sdbusplus::bus::match::rules::member("PropertiesChanged") +
+                sdbusplus::bus::match::rules::path(
+                    BOOT_RAW_PATH_PREFIX + std::to_string(host_num)) +
+                sdbusplus::bus::match::rules::argN(0, BOOT_RAW_INTF) +
+                sdbusplus::bus::match::rules::interface(
+                    CpuInfoDataHolder::PropertiesIntf),
+            [this](sdbusplus::message::message &msg) {
+                // any POST code means host firmware runs, the value is not needed
+                boot_progress(true);
+            })
     {
-       sd_journal_print(LOG_DEBUG, "cpu service start... \n");
+       set_capabilities(services.caps);
+       set_backend(services.apml);
+#ifdef ENABLE_LAZY_FIELDS
+       lazy = true;
+#endif
+       sd_journal_print(LOG_DEBUG, "host%d cpu service start... \n", host_num);
     }
     ~CpuInfo()
     {
+        sd_event_source_unref(boot_timer);
+        sd_event_source_unref(host_state_timer);
+        for (auto& waiter : lazy_waiters)
+        {
+            sd_bus_message_unref(waiter.msg);
+        }
+    }
+
+    // read the current host state once, collect if it is already running
+    void init_host_state();
+
+    // lazy mode, event loop thread only
+    bool lazy_fetched(uint8_t soc_num, LazyStep step) const;
+    uint8_t lazy_unfetched(uint8_t soc_num) const;
+    // queue the steps and reply to msg once they were all read
+    int fetch_lazy(sd_bus_message *msg, uint8_t soc_num, uint8_t steps);
+    // queue a read of step, collapsed with any read already queued, false
+    // when the socket did not answer the last collection
+    bool request_lazy(uint8_t soc_num, LazyStep step);
+    CpuShmRecord lazy_record(uint8_t soc_num) const
+    {
+        return snapshot.record(soc_num);
     }
 
   private:
+    // drives publish directly, test/cpu_info_test.hpp
+    friend class CpuInfoTest;
 
     sdbusplus::bus::bus &bus;
+    WorkerPool &pool;
+    CpuShmWriter &snapshot;
+    WorkerPool *background;
+    TelemetrySampler *telemetry;
+    ServiceNotifier *notifier;
+    InventoryEvents *events;
+    CollectionStats *stats;
+    sd_event *event;
     sdbusplus::bus::match_t propertiesChangedCpuInfoValue;
     sdbusplus::bus::match_t propertiesChangedSignalCurrentHostState;
-    std::string get_interface(uint8_t enum_val);
-    uint8_t num_of_proc = 1;
-    unsigned int num_of_cpu = 0;
-
-    // oob-lib functions
-    bool getNumberOfCpu();
-    void collect_cpu_information();
-    int  getGPIOValue(const std::string& name);
-    void set_general_info(uint8_t soc_num);
-    bool connect_apml_get_family_model_step(uint8_t soc_num);
-    void get_threads_per_core_and_soc(uint8_t soc_num);
-    void get_cpu_base_freq(uint8_t soc_num);
-    void get_ppin_fuse(uint8_t soc_num);
-    void get_microcode_rev(uint8_t soc_num);
-
-    //DBUS functions
-    void set_cpu_string_value(uint8_t soc_num, std::string value, std::string property_name, uint8_t enum_val);
-    void set_cpu_int_value(uint8_t soc_num, uint32_t value, std::string property_name, uint8_t enum_val);
-    void set_cpu_int16_value(uint8_t soc_num, uint16_t value, std::string property_name, uint8_t enum_val);
-    void set_cpu_bool_value(uint8_t soc_num, bool value, std::string property_name, uint8_t enum_val);
-
-    //decode ppin function
-    void decode_PPIN(uint8_t soc_num, uint64_t data);
-    void decode_lotstring(char* ppinstr, std::string& );
-    void decode_datemonth_unitlot(char* ppinstr, std::string& datemonthlotstr);
-
-    //OPN functions
-    void get_opn(uint8_t soc_num);
-    bool read_register(uint8_t soc_num, uint32_t thread_ind, uint32_t cpuid_fn, uint32_t cpuid_extd_fn, uint32_t *eax_value, uint32_t *ebx_value, uint32_t *ecx_value, uint32_t *edx_value);
-    u_int8_t get_reg_offset_conv(uint32_t reg, uint32_t offset, uint32_t flag);
+    sdbusplus::bus::match_t propertiesChangedBootProgress;
+    sdbusplus::bus::match_t propertiesChangedPostCode;
+    const char* get_interface(uint8_t enum_val);
+
+    // collection state, only touched from the event loop thread
+    bool collecting = false;
+    bool recollect = false;
+    unsigned int outstanding_sets = 0;
+    // a time-to-inventory sample runs from the first trigger to the last Set reply
+    bool measuring = false;
+    std::chrono::steady_clock::time_point inventory_start;
+
+    enum BootGate : uint8_t
+    {
+        BOOT_IDLE,      // host off
+        BOOT_WAITING,   // host on, no boot progress yet
+        BOOT_PROBING,   // firmware runs, APML not answering yet
+        BOOT_OPEN,      // collections start on every host signal
+    };
+    sd_event_source *boot_timer = nullptr;
+    BootGate boot_gate = BOOT_IDLE;
+    // boot progress published and sent during the last boot
+    bool boot_signals = false;
+    std::chrono::steady_clock::time_point probe_deadline;
+    // CurrentHostState read or signalled once, the host is only declared
+    // ready while off after that
+    bool host_state_known = false;
+    // last CurrentHostState was not Off, boot progress is ignored otherwise
+    bool host_running = false;
+    sd_event_source *host_state_timer = nullptr;
+
+    bool enumerating = false;
+    std::map<uint8_t, std::unique_ptr<CoreMapObject>> core_maps;
+
+    enum LazyState : uint8_t
+    {
+        LAZY_PENDING,
+        LAZY_QUEUED,
+        LAZY_FETCHING,
+        LAZY_DONE,
+    };
+    // Fetch call waiting for some steps of one socket
+    struct LazyWaiter
+    {
+        sd_bus_message *msg;
+        uint8_t soc_num;
+        uint8_t steps;
+    };
+    // at most one APML job per host, either a collection or a lazy read
+    bool fetching = false;
+    // bit n set when socket n of the host answered the last collection
+    uint8_t lazy_present = 0;
+    LazyState lazy_state[MAX_SOCKETS_PER_HOST][LAZY_STEP_COUNT] = {};
+    std::vector<LazyWaiter> lazy_waiters;
+    std::map<uint8_t, std::unique_ptr<LazyFieldsObject>> lazy_fields;
+
+    void run_lazy();
+    void lazy_collected(const std::vector<uint8_t>& sockets);
+    void lazy_host_off();
+    void reply_lazy_waiters();
 
+    void begin_measure();
+    void start_collection();
+    bool read_host_state();
+    void retry_host_state();
+    static int on_host_state_timer(sd_event_source *source, uint64_t usec, void *userdata);
+    bool read_boot_progress(bool& started);
+    void on_boot_progress(sdbusplus::message::message &msg);
+    void boot_progress(bool started);
+    void boot_host_on();
+    void boot_host_off();
+    void open_boot_gate(const char *reason);
+    void start_probe();
+    void probe_done(bool ready);
+    bool arm_boot_timer(uint64_t usec);
+    static int on_boot_timer(sd_event_source *source, uint64_t usec, void *userdata);
+    void record_snapshot(uint8_t soc_num, bool full, bool answered, uint32_t read);
+    // CpuShmField bits a full collection reads, without the lazy ones in lazy mode
+    uint32_t collection_fields() const;
+    static uint32_t lazy_step_fields(LazyStep step);
+    void publish(const std::vector<PendingProperty>& props);
+    int append_property(sd_bus_message *method, const PendingProperty& prop);
+    static int set_property_reply(sd_bus_message* reply, void* userdata, sd_bus_error* error);
+    void sets_done();
+    void start_core_enumeration(const std::vector<uint8_t>& sockets);
+    void stop_telemetry();
+    void on_step(uint8_t soc_num, const char *step) override;
 };
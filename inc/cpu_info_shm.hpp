@@ -0,0 +1,167 @@
+#pragma once
+
+// Header only reader of the CPU inventory snapshot kept by cpu-info.
+//
+// The snapshot is a fixed layout file under /run that cpu-info maps and
+// updates in place. Every socket slot is guarded by its own sequence
+// counter (seqlock): the writer makes it odd before touching the record
+// and even again afterwards, a reader retries while it is odd or changed
+// across the read. After open() no syscall is needed to read.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#define CPU_SHM_DIR           "/run/cpu-info"
+#define CPU_SHM_PATH          CPU_SHM_DIR "/inventory"
+#define CPU_SHM_MAGIC         (0x49555043) // "CPUI"
+#define CPU_SHM_VERSION       (1)
+#define CPU_SHM_MAX_SOCKETS   (16)
+#define CPU_SHM_STR_LEN       (64)
+#define CPU_SHM_READ_RETRY    (1000)
+
+// Fields of a record, in the order of cpu_shm_field_names
+enum CpuShmField
+{
+    SHM_EFFECTIVE_FAMILY,
+    SHM_FAMILY,
+    SHM_EFFECTIVE_MODEL,
+    SHM_MODEL,
+    SHM_STEP,
+    SHM_SOCKET,
+    SHM_MANUFACTURER,
+    SHM_VENDOR_ID,
+    SHM_PPIN,
+    SHM_SERIAL_NUMBER,
+    SHM_MICROCODE,
+    SHM_PART_NUMBER,
+    SHM_STRING_FIELDS,
+    SHM_MAX_SPEED = SHM_STRING_FIELDS,
+    SHM_THREAD_COUNT,
+    SHM_CORE_COUNT,
+    SHM_PRESENT,
+    SHM_FIELD_COUNT
+};
+
+// D-Bus property name of every field, as published to the Inventory Manager
+static const char *const cpu_shm_field_names[SHM_FIELD_COUNT] = {
+    "EffectiveFamily", "Family", "EffectiveModel", "Model", "Step", "Socket",
+    "Manufacturer", "VendorId", "PPIN", "SerialNumber", "Microcode", "PartNumber",
+    "MaxSpeedInMhz", "ThreadCount", "CoreCount", "Present"};
+
+struct CpuShmRecord
+{
+    // bumped on every update of this socket
+    uint64_t generation;
+    // CLOCK_MONOTONIC time of the last update
+    uint64_t updated_usec;
+    // bit n set when field n holds a value
+    uint32_t valid;
+    uint32_t max_speed_mhz;
+    uint16_t thread_count;
+    uint16_t core_count;
+    uint8_t present;
+    uint8_t reserved[3];
+    char strings[SHM_STRING_FIELDS][CPU_SHM_STR_LEN];
+};
+
+struct CpuShmSlot
+{
+    std::atomic<uint32_t> seq;
+    uint32_t reserved;
+    CpuShmRecord record;
+};
+
+struct CpuShmHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t num_sockets;
+    CpuShmSlot slots[CPU_SHM_MAX_SOCKETS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "seqlock counter must be address free for shared memory");
+
+class CpuShmReader
+{
+  public:
+    CpuShmReader() = default;
+    ~CpuShmReader()
+    {
+        close();
+    }
+    CpuShmReader(const CpuShmReader&) = delete;
+    CpuShmReader& operator=(const CpuShmReader&) = delete;
+
+    bool open(const char *path = CPU_SHM_PATH)
+    {
+        close();
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        void *addr = mmap(nullptr, sizeof(CpuShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED)
+            return false;
+        header = static_cast<const CpuShmHeader *>(addr);
+        if (header->magic != CPU_SHM_MAGIC || header->version != CPU_SHM_VERSION ||
+            header->size != sizeof(CpuShmHeader))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (header)
+            munmap(const_cast<CpuShmHeader *>(header), sizeof(CpuShmHeader));
+        header = nullptr;
+    }
+
+    uint32_t num_sockets() const
+    {
+        return header ? header->num_sockets : 0;
+    }
+
+    // Run fn(const CpuShmRecord&) on the record in place, retried until it
+    // saw a consistent record. fn may run more than once, it must only
+    // read from the record.
+    template <typename F>
+    bool visit(uint8_t soc_num, F&& fn) const
+    {
+        if (!header || soc_num >= CPU_SHM_MAX_SOCKETS)
+            return false;
+        const CpuShmSlot& slot = header->slots[soc_num];
+        for (int retry = 0; retry < CPU_SHM_READ_RETRY; retry++)
+        {
+            uint32_t begin = slot.seq.load(std::memory_order_acquire);
+            if (begin & 1)
+                continue;
+            fn(slot.record);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == begin)
+                return true;
+        }
+        return false;
+    }
+
+    // Consistent copy of one socket's record
+    bool read(uint8_t soc_num, CpuShmRecord& out) const
+    {
+        return visit(soc_num, [&out](const CpuShmRecord& record) {
+            memcpy(&out, &record, sizeof(out));
+        });
+    }
+
+  private:
+    const CpuShmHeader *header = nullptr;
+};
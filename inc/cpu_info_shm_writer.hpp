@@ -0,0 +1,31 @@
+#pragma once
+
+#include "cpu_collector.hpp"
+#include "cpu_info_shm.hpp"
+
+// Owner side of the snapshot, used from the event loop thread only
+class CpuShmWriter
+{
+  public:
+    CpuShmWriter() = default;
+    ~CpuShmWriter();
+    CpuShmWriter(const CpuShmWriter&) = delete;
+    CpuShmWriter& operator=(const CpuShmWriter&) = delete;
+
+    bool open(const char *path = CPU_SHM_PATH);
+    // Replace the record of one socket with a full collection, present is
+    // whether it answered. Fields the collection did not read are cleared.
+    void replace(uint8_t soc_num, bool present, const std::vector<PendingProperty>& props);
+    // Apply the properties of a partial read, e.g. a lazy field, to one socket
+    void update(uint8_t soc_num, const std::vector<PendingProperty>& props);
+    // soc_num was published by an earlier run of the service
+    bool has_record(uint8_t soc_num) const;
+    // copy of the record, only the writer thread may call it without the seqlock
+    CpuShmRecord record(uint8_t soc_num) const;
+
+  private:
+    void write(uint8_t soc_num, const std::vector<PendingProperty>& props, bool full,
+               bool present);
+
+    CpuShmHeader *header = nullptr;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <systemd/sd-journal.h>
+
+#include <cstdarg>
+
+// Identical errors are logged at most LOG_RATE_BURST times per
+// LOG_RATE_INTERVAL_SEC, a reboot storm must not fill the BMC flash
+#define LOG_RATE_BURST          (5)
+#define LOG_RATE_INTERVAL_SEC   (600)
+#define LOG_RATE_SITES          (64)
+
+// Per operation details on the collection path, only built in with
+// ENABLE_CPU_INFO_LOGS. The disabled form still type checks the arguments.
+#ifdef ENABLE_CPU_INFO_LOGS
+#define CPU_INFO_DEBUG(...)     sd_journal_print(LOG_DEBUG, __VA_ARGS__)
+#else
+#define CPU_INFO_DEBUG(...)     do { if (0) sd_journal_print(LOG_DEBUG, __VA_ARGS__); } while (0)
+#endif
+
+// Rate limited journal print. Messages are told apart by their format
+// string, the number dropped is reported once the interval is over.
+int log_ratelimited(int priority, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int log_ratelimited_v(int priority, const char *fmt, va_list args);
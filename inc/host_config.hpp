@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define MAX_SOCKETS_PER_HOST  (2)
+#define INVENTORY_PROC_PATH   "/xyz/openbmc_project/inventory/system/processor/P"
+// inventory prefix and the <n> of a processor
+#define PROC_PATH_LEN         (128)
+#define PRESENT_GPIO_FMT      "P%d_PRESENT_L"
+
+// Wiring of one host. Every field can be set in the u-boot environment as
+// host<N>_num_of_cpu, host<N>_apml_base, host<N>_inventory_base,
+// host<N>_inventory_prefix and host<N>_present_gpios (comma separated).
+struct HostConfig
+{
+    // sockets of the host, num_of_cpu when host<N>_num_of_cpu is not set
+    uint8_t num_of_cpu = 1;
+    // libapml index of the first socket, the others follow it
+    uint8_t apml_base = 0;
+    // <n> of the first P<n> processor, the others follow, unique across hosts
+    uint8_t inventory_base = 0;
+    // Inventory Manager path of a processor, without its <n>
+    std::string inventory_prefix = INVENTORY_PROC_PATH;
+    // presence line of each socket, high when the socket is empty
+    std::string present_gpios[MAX_SOCKETS_PER_HOST];
+};
+
+// processors P(2N) and P(2N+1) with their P<n>_PRESENT_L lines, libapml
+// sockets 0 and 1
+HostConfig default_host_config(uint8_t host_num);
+
+// one config per host, from a single read of the u-boot environment
+std::vector<HostConfig> load_host_configs(unsigned int num_of_hosts);
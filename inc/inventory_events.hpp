@@ -0,0 +1,52 @@
+#pragma once
+
+#include "apml_caps.hpp"
+#include "cpu_info_shm.hpp"
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/vtable.hpp>
+
+#include <string>
+
+#define INVENTORY_EVENTS_INTF   "xyz.openbmc_project.Inventory.Item.Cpu.InventoryEvents"
+#define INVENTORY_CHANGED       "CpuInventoryChanged"
+// PPIN, SerialNumber, PartNumber and Microcode
+#define IDENTITY_FIELD_COUNT    (4)
+// next to the capability cache, survives an AC loss unlike the snapshot
+#define IDENTITY_PATH           APML_CAPS_DIR "/identity"
+
+// Emits one CpuInventoryChanged(socket, changed_fields, old, new) signal on
+// DBUS_OBJECT_NAME when a collection changes the identity of a socket, so
+// that fleet tools do not have to follow every PropertiesChanged
+class InventoryEvents
+{
+  public:
+    explicit InventoryEvents(sdbusplus::bus::bus &bus, const char *path = IDENTITY_PATH);
+
+    // after is the record once a collection was stored, read the mask of
+    // CpuShmField bits it tried to read, fields that failed are skipped.
+    // before, the record it replaced, seeds the baseline of a socket on its
+    // first collection when IDENTITY_PATH holds none for it.
+    void compare(uint8_t soc_num, const CpuShmRecord& before, const CpuShmRecord& after,
+                 uint32_t read);
+
+  private:
+    static const sd_bus_vtable vtable[];
+
+    void load();
+    void save();
+
+    // last identity of a socket, known is false until a field was read
+    struct Identity
+    {
+        bool seeded;
+        bool known[IDENTITY_FIELD_COUNT];
+        char values[IDENTITY_FIELD_COUNT][CPU_SHM_STR_LEN];
+    };
+    Identity identities[CPU_SHM_MAX_SOCKETS] = {};
+    std::string path;
+
+    sdbusplus::bus::bus &bus;
+    sdbusplus::server::interface_t intf;
+};
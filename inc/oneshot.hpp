@@ -0,0 +1,8 @@
+#pragma once
+
+#include "apml_backend.hpp"
+
+// Collect every socket once and print the result to stdout, without D-Bus,
+// as one JSON document or as text. num_sockets of 0 reads the socket count
+// from the u-boot env.
+int run_oneshot(unsigned int num_sockets, bool json, ApmlBackend *apml);
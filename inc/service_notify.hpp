@@ -0,0 +1,49 @@
+#pragma once
+
+#include <systemd/sd-event.h>
+
+#include <chrono>
+#include <vector>
+
+// longest a healthy collection of one host can take, MAX_RETRY * MUX_SLEEP
+// on family and PPIN of two sockets plus margin
+#define COLLECTION_TIMEOUT_SEC  (600)
+
+// systemd Type=notify integration. READY=1 is sent once every host is
+// either published, off or covered by a warm snapshot, STATUS= reports
+// progress and WATCHDOG=1 is sent from the event loop as long as no
+// collection is stuck on the bus.
+class ServiceNotifier
+{
+  public:
+    ServiceNotifier(sd_event *event, unsigned int num_of_hosts);
+    ~ServiceNotifier();
+
+    ServiceNotifier(const ServiceNotifier&) = delete;
+    ServiceNotifier& operator=(const ServiceNotifier&) = delete;
+
+    // event loop thread only
+    void host_ready(unsigned int host_num, const char *reason);
+    void collection_started(unsigned int host_num);
+    void collection_done(unsigned int host_num);
+
+    // any thread
+    void status(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  private:
+    static int on_watchdog(sd_event_source *source, uint64_t usec, void *userdata);
+
+    struct Host
+    {
+        bool ready = false;
+        bool collecting = false;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    std::vector<Host> hosts;
+    bool notified_ready = false;
+    // keep-alive withheld on the last tick
+    bool stalled = false;
+    uint64_t watchdog_usec = 0;
+    sd_event_source *watchdog_source = nullptr;
+};
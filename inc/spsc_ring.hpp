@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Fixed memory single producer / single consumer ring. Each side is owned
+// by one thread: only the producer calls push(), only the consumer pop().
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+
+  public:
+    // false when full, the caller decides whether to drop or retry
+    bool push(const T& item)
+    {
+        size_t head = head_idx.load(std::memory_order_relaxed);
+        if (head - tail_idx.load(std::memory_order_acquire) == N)
+            return false;
+        items[head & (N - 1)] = item;
+        head_idx.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool push(T&& item)
+    {
+        size_t head = head_idx.load(std::memory_order_relaxed);
+        if (head - tail_idx.load(std::memory_order_acquire) == N)
+            return false;
+        items[head & (N - 1)] = std::move(item);
+        head_idx.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // copy out up to max items, oldest first
+    size_t pop(T *out, size_t max)
+    {
+        size_t tail = tail_idx.load(std::memory_order_relaxed);
+        size_t count = head_idx.load(std::memory_order_acquire) - tail;
+        if (count > max)
+            count = max;
+        for (size_t i = 0; i < count; i++)
+            out[i] = items[(tail + i) & (N - 1)];
+        tail_idx.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // move out the oldest item, false when empty
+    bool pop(T& out)
+    {
+        size_t tail = tail_idx.load(std::memory_order_relaxed);
+        if (head_idx.load(std::memory_order_acquire) == tail)
+            return false;
+        out = std::move(items[tail & (N - 1)]);
+        tail_idx.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // items queued, exact only on the producer or consumer thread
+    size_t size() const
+    {
+        return head_idx.load(std::memory_order_acquire) - tail_idx.load(std::memory_order_acquire);
+    }
+
+  private:
+    T items[N];
+    alignas(64) std::atomic<size_t> head_idx{0};
+    alignas(64) std::atomic<size_t> tail_idx{0};
+};
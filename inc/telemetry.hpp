@@ -0,0 +1,126 @@
+#pragma once
+
+#include "apml_backend.hpp"
+#include "spsc_ring.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// base sampling period, overridable from CMake
+#ifndef TELEMETRY_PERIOD_MS
+#define TELEMETRY_PERIOD_MS        (1000)
+#endif
+// slowest period the sampler backs off to under bus load
+#define TELEMETRY_MAX_PERIOD_MS    (60 * 1000)
+// limits change rarely, read them every N samples
+#define TELEMETRY_LIMIT_DIVIDER    (10)
+// min/avg/max summaries cover this window
+#define TELEMETRY_WINDOW_MS        (60 * 1000)
+// share of the period the sampler may keep the APML bus busy, in percent
+#define TELEMETRY_MAX_BUS_SHARE    (20)
+// raw samples kept per socket, power of two
+#define TELEMETRY_RING_SIZE        (256)
+#define TELEMETRY_MAX_SOCKETS      (16)
+
+#define TELEMETRY_POWER_VALID       (1 << 0)
+#define TELEMETRY_POWER_LIMIT_VALID (1 << 1)
+#define TELEMETRY_BOOST_VALID       (1 << 2)
+#define TELEMETRY_TEMP_VALID        (1 << 3)
+
+struct TelemetrySample
+{
+    // CLOCK_MONOTONIC time of the sample
+    uint64_t usec;
+    uint32_t power_mw;
+    uint32_t power_limit_mw;
+    uint32_t boost_limit_mhz;
+    int32_t temp_mdegc;
+    // TELEMETRY_*_VALID bits of the fields read successfully
+    uint32_t valid;
+};
+
+struct TelemetrySummary
+{
+    uint8_t soc_num;
+    uint32_t samples;
+    uint32_t power_min_mw;
+    uint32_t power_avg_mw;
+    uint32_t power_max_mw;
+    int32_t temp_min_mdegc;
+    int32_t temp_avg_mdegc;
+    int32_t temp_max_mdegc;
+    uint32_t power_limit_mw;
+    uint32_t boost_limit_mhz;
+    uint32_t period_ms;
+    uint64_t dropped;
+};
+
+// Samples socket power, power limit, boost limit and SB-TSI temperature
+// over APML on its own thread. The period grows when the calls take more
+// than TELEMETRY_MAX_BUS_SHARE of it or fail, and sampling pauses while
+// an inventory collection owns the bus.
+class TelemetrySampler
+{
+  public:
+    // on_summary runs on the sampler thread once per window and socket
+    using SummaryHandler = std::function<void(const TelemetrySummary&)>;
+
+    // APML reads go through apml, recorded or replayed like the collection
+    TelemetrySampler(uint32_t period_ms, ApmlBackend *apml, SummaryHandler on_summary);
+    ~TelemetrySampler();
+
+    TelemetrySampler(const TelemetrySampler&) = delete;
+    TelemetrySampler& operator=(const TelemetrySampler&) = delete;
+
+    // soc_num is the <n> of P<n>, apml_socket its libapml index
+    void set_active(uint8_t soc_num, bool active, uint8_t apml_socket);
+    // inventory collection in progress, nests
+    void bus_busy(bool busy);
+    // drain raw samples of soc_num, event loop thread only
+    size_t drain(uint8_t soc_num, TelemetrySample *out, size_t max);
+
+  private:
+    struct Window
+    {
+        uint32_t samples = 0;
+        uint32_t temp_samples = 0;
+        uint32_t power_min = UINT32_MAX;
+        uint32_t power_max = 0;
+        uint64_t power_sum = 0;
+        int32_t temp_min = INT32_MAX;
+        int32_t temp_max = INT32_MIN;
+        int64_t temp_sum = 0;
+    };
+    struct Socket
+    {
+        // pushed by the sampler thread, popped by the event loop thread
+        SpscRing<TelemetrySample, TELEMETRY_RING_SIZE> ring;
+        Window window;
+        TelemetrySample last = {};
+        uint64_t dropped = 0;
+        uint8_t apml_socket = 0;
+    };
+
+    void sampler_main();
+    uint64_t sample(Socket& socket, bool read_limits, bool& failed);
+    void flush_window(uint8_t soc_num, Socket& socket);
+
+    const uint32_t base_period_ms;
+    uint32_t period_ms;
+    ApmlBackend *apml;
+    SummaryHandler on_summary;
+    std::atomic<uint32_t> active_mask{0};
+    std::atomic<int> busy_count{0};
+    bool stopping = false;
+    std::mutex stop_lock;
+    std::condition_variable stop_cv;
+    // created by set_active on the loop thread before the bit is set
+    std::unique_ptr<Socket> sockets[TELEMETRY_MAX_SOCKETS];
+    std::thread thread;
+};
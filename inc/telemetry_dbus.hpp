@@ -0,0 +1,58 @@
+#pragma once
+
+#include "telemetry.hpp"
+#include "worker_pool.hpp"
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/vtable.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#define TELEMETRY_INTF        "xyz.openbmc_project.Inventory.Item.Cpu.Telemetry"
+// most samples one Drain call returns
+#define TELEMETRY_DRAIN_MAX   (TELEMETRY_RING_SIZE)
+
+// Window summary and raw sample drain of one socket, served by this service
+// under DBUS_OBJECT_NAME/P<n>
+class TelemetryObject
+{
+  public:
+    TelemetryObject(sdbusplus::bus::bus &bus, uint8_t soc_num, TelemetrySampler &sampler);
+    void update(const TelemetrySummary& new_summary);
+
+  private:
+    static int get_property(sd_bus *bus, const char *path, const char *interface,
+                            const char *property, sd_bus_message *reply,
+                            void *userdata, sd_bus_error *error);
+    static int drain(sd_bus_message *msg, void *userdata, sd_bus_error *error);
+    static const sd_bus_vtable vtable[];
+
+    uint8_t soc_num;
+    TelemetrySampler &sampler;
+    std::string path;
+    TelemetrySummary summary = {};
+    sdbusplus::server::interface_t intf;
+};
+
+// Owns the sampler and publishes its summaries from the event loop
+class TelemetryService
+{
+  public:
+    TelemetryService(sdbusplus::bus::bus &bus, WorkerPool &pool, uint32_t period_ms,
+                     ApmlBackend *apml);
+
+    TelemetrySampler& get_sampler()
+    {
+        return sampler;
+    }
+
+  private:
+    sdbusplus::bus::bus &bus;
+    WorkerPool &pool;
+    std::map<uint8_t, std::unique_ptr<TelemetryObject>> objects;
+    // last member, its thread stops before the objects go away
+    TelemetrySampler sampler;
+};
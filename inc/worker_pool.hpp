@@ -0,0 +1,123 @@
+#pragma once
+
+#include "spsc_ring.hpp"
+
+#include <systemd/sd-event.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// jobs or completions one queue holds, a host has at most one job queued
+#define WORKER_QUEUE_SIZE     (64)
+// threads that may post to the loop of one pool
+#define LOOP_PRODUCERS_MAX    (16)
+// pools one thread posts to, the completion queue is looked up here
+#define THREAD_POOLS_MAX      (8)
+
+// Queue figures of a pool, wait is the time from post to start of run
+struct WorkerPoolStats
+{
+    uint64_t jobs;
+    uint64_t job_wait_max_usec;
+    uint64_t job_wait_total_usec;
+    uint64_t completions;
+    uint64_t completion_wait_max_usec;
+    uint64_t completion_wait_total_usec;
+    uint32_t job_depth_max;
+    uint32_t completion_depth_max;
+};
+
+// Fixed set of threads shared by all hosts for blocking APML work.
+// Completions are handed back to the sd_event loop so that D-Bus is only
+// ever touched from the loop thread.
+//
+// Every worker has its own lock-free SPSC job queue fed by the loop thread
+// and woken through an eventfd. Every thread posting to the loop has its
+// own SPSC completion queue, drained on the loop eventfd. Neither side
+// takes a lock the other one holds.
+class WorkerPool
+{
+  public:
+    WorkerPool(sd_event *event, unsigned int threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Run job on worker lane % threads, loop thread only. Jobs of one lane
+    // run in the order posted, e.g. lane = host number.
+    void post(std::function<void()> job, unsigned int lane = 0);
+    // Run fn on the event loop thread, callable from any thread
+    void post_to_loop(std::function<void()> fn);
+
+    // loop thread only
+    WorkerPoolStats stats() const;
+    void reset_stats();
+
+  private:
+    struct Task
+    {
+        std::function<void()> fn;
+        std::chrono::steady_clock::time_point queued;
+    };
+    using TaskQueue = SpscRing<Task, WORKER_QUEUE_SIZE>;
+
+    struct Worker
+    {
+        TaskQueue jobs;
+        int wake_fd = -1;
+        std::thread thread;
+        // written by the worker, read by the loop
+        std::atomic<uint64_t> runs{0};
+        std::atomic<uint64_t> wait_max_usec{0};
+        std::atomic<uint64_t> wait_total_usec{0};
+    };
+
+    // completion queue of a pool cached by a thread posting to it,
+    // generation 0 marks a free entry
+    struct CacheEntry
+    {
+        std::atomic<uint64_t> generation{0};
+        TaskQueue *queue = nullptr;
+        WorkerPool *pool = nullptr;
+        unsigned int producer = 0;
+    };
+    // cache of one thread, its exit unlinks the entries from their pools
+    struct ThreadCache
+    {
+        CacheEntry entries[THREAD_POOLS_MAX];
+        ~ThreadCache();
+    };
+
+    static int on_loop_event(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+    static void push_task(TaskQueue& queue, Task&& task);
+    static void wake(int fd);
+    void worker_main(Worker& worker);
+    TaskQueue& loop_queue();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> stopping{false};
+    // unique per pool for the process lifetime, a pool later allocated at
+    // the address of a destroyed one never hits its cached queues
+    const uint64_t generation;
+
+    // completion queue of every thread that posted to the loop so far
+    std::unique_ptr<TaskQueue> producers[LOOP_PRODUCERS_MAX];
+    std::atomic<unsigned int> num_producers{0};
+    std::mutex producers_lock;
+    // cache entry of each producer, freed when the pool goes away,
+    // nullptr once its thread exited
+    CacheEntry *producer_entries[LOOP_PRODUCERS_MAX] = {};
+
+    // loop thread side figures
+    WorkerPoolStats loop_stats = {};
+
+    int loop_fd = -1;
+    sd_event_source *loop_source = nullptr;
+};
@@ -0,0 +1,647 @@
+#include "apml_backend.hpp"
+#include "cpu_log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+extern "C" {
+#include "esmi_mailbox.h"
+#include "esmi_rmi.h"
+#include "esmi_tsi.h"
+}
+
+#define TRACE_LINE_LEN  (160)
+// longer gaps between recorded calls are idle time between collections,
+// not part of one, and are not replayed
+#define REPLAY_GAP_MAX_USEC  (10 * 1000000ULL)
+
+// trace name of each ApmlCall
+static const char *call_names[APML_CALL_COUNT] = {
+    "cpuid",
+    "cpuid_eax",
+    "cpuid_ebx",
+    "cpuid_ecx",
+    "cpuid_edx",
+    "threads_per_socket",
+    "threads_per_core",
+    "read_mailbox",
+    "rmi_revision",
+    "socket_power",
+    "socket_power_limit",
+    "boost_limit",
+    "cpu_temp",
+    "present_gpio",
+    "read_msr",
+};
+
+void ApmlBackend::pause(unsigned int usec)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(usec));
+}
+
+ApmlBackend& libapml_backend()
+{
+    static LibApmlBackend backend;
+    return backend;
+}
+
+oob_status_t LibApmlBackend::cpuid(uint8_t soc_num, uint32_t thread, uint32_t *eax,
+                                   uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    return esmi_oob_cpuid(soc_num, thread, eax, ebx, ecx, edx);
+}
+
+oob_status_t LibApmlBackend::cpuid_reg(ApmlCpuidReg reg, uint8_t soc_num, uint32_t thread,
+                                       uint32_t fn, uint32_t extd_fn, uint32_t *value)
+{
+    switch (reg)
+    {
+        case APML_CPUID_EAX:
+            return esmi_oob_cpuid_eax(soc_num, thread, fn, extd_fn, value);
+        case APML_CPUID_EBX:
+            return esmi_oob_cpuid_ebx(soc_num, thread, fn, extd_fn, value);
+        case APML_CPUID_ECX:
+            return esmi_oob_cpuid_ecx(soc_num, thread, fn, extd_fn, value);
+        case APML_CPUID_EDX:
+            return esmi_oob_cpuid_edx(soc_num, thread, fn, extd_fn, value);
+        default:
+            return OOB_NOT_SUPPORTED;
+    }
+}
+
+oob_status_t LibApmlBackend::threads_per_socket(uint8_t soc_num, uint32_t *value)
+{
+    return esmi_get_threads_per_socket(soc_num, value);
+}
+
+oob_status_t LibApmlBackend::threads_per_core(uint8_t soc_num, uint32_t *value)
+{
+    return esmi_get_threads_per_core(soc_num, value);
+}
+
+oob_status_t LibApmlBackend::read_mailbox(uint8_t soc_num, uint32_t cmd, uint32_t arg,
+                                          uint32_t *value)
+{
+    return esmi_oob_read_mailbox(soc_num, cmd, arg, value);
+}
+
+oob_status_t LibApmlBackend::rmi_revision(uint8_t soc_num, uint8_t *rev)
+{
+    return read_sbrmi_revision(soc_num, rev);
+}
+
+oob_status_t LibApmlBackend::socket_power(uint8_t soc_num, uint32_t *mw)
+{
+    return read_socket_power(soc_num, mw);
+}
+
+oob_status_t LibApmlBackend::socket_power_limit(uint8_t soc_num, uint32_t *mw)
+{
+    return read_socket_power_limit(soc_num, mw);
+}
+
+oob_status_t LibApmlBackend::boost_limit(uint8_t soc_num, uint32_t cpu, uint32_t *mhz)
+{
+    return read_esb_boost_limit(soc_num, cpu, mhz);
+}
+
+oob_status_t LibApmlBackend::cpu_temp(uint8_t soc_num, float *temp)
+{
+    return sbtsi_get_cputemp(soc_num, temp);
+}
+
+// the line is looked up and requested on the first read, a line that fails
+// then stays unused
+oob_status_t LibApmlBackend::present_gpio(uint8_t soc_num, PresentGpio& gpio, int *value)
+{
+    if (!gpio.requested)
+    {
+        gpio.requested = true;
+        gpio.line = gpiod::find_line(gpio.name);
+        if (!gpio.line)
+        {
+            sd_journal_print(LOG_ERR, "Can't find line: %s \n", gpio.name.c_str());
+            return OOB_NOT_FOUND;
+        }
+        try
+        {
+            gpio.line.request({__FUNCTION__, gpiod::line_request::DIRECTION_INPUT});
+        }
+        catch (std::system_error& exc)
+        {
+            sd_journal_print(LOG_ERR, "Error setting gpio as Input: %s \n", gpio.name.c_str());
+            gpio.line = gpiod::line();
+            return OOB_FILE_ERROR;
+        }
+    }
+    if (!gpio.line)
+    {
+        return OOB_NOT_FOUND;
+    }
+
+    try
+    {
+        *value = gpio.line.get_value();
+    }
+    catch (std::system_error& exc)
+    {
+        log_ratelimited(LOG_ERR, "Error getting gpio value for P%d \n", soc_num);
+        return OOB_FILE_ERROR;
+    }
+    return OOB_SUCCESS;
+}
+
+oob_status_t LibApmlBackend::read_msr(uint8_t soc_num, uint32_t thread, uint32_t msr,
+                                      uint64_t *value)
+{
+    return esmi_oob_read_msr(soc_num, thread, msr, value);
+}
+
+RecordingBackend::RecordingBackend(ApmlBackend &target, const char *path) :
+    target(target), origin_usec(now_usec())
+{
+    file = fopen(path, "w");
+    if (file == NULL)
+    {
+        sd_journal_print(LOG_ERR, "Failed to open APML trace %s : %d \n", path, errno);
+        return;
+    }
+    fprintf(file, "%s\n# call soc a0 a1 a2 status o0 o1 o2 o3 start_usec dur_usec\n",
+            APML_TRACE_HEADER);
+}
+
+RecordingBackend::~RecordingBackend()
+{
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+}
+
+uint64_t RecordingBackend::now_usec() const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// flushed per call, a trace cut short by a crash keeps what ran before
+void RecordingBackend::write(const ApmlTraceRecord& record)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (file == NULL)
+    {
+        return;
+    }
+    fprintf(file, "%s %u %x %x %x %d %x %x %x %x %llu %llu\n", call_names[record.call],
+            record.soc_num, record.args[0], record.args[1], record.args[2], record.status,
+            record.out[0], record.out[1], record.out[2], record.out[3],
+            (unsigned long long)(record.start_usec - origin_usec),
+            (unsigned long long)record.dur_usec);
+    fflush(file);
+}
+
+oob_status_t RecordingBackend::cpuid(uint8_t soc_num, uint32_t thread, uint32_t *eax,
+                                     uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    ApmlTraceRecord record = {APML_CPUID, soc_num, {thread, *eax, *ecx}};
+    record.start_usec = now_usec();
+    oob_status_t ret = target.cpuid(soc_num, thread, eax, ebx, ecx, edx);
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = *eax;
+        record.out[1] = *ebx;
+        record.out[2] = *ecx;
+        record.out[3] = *edx;
+    }
+    write(record);
+    return ret;
+}
+
+oob_status_t RecordingBackend::cpuid_reg(ApmlCpuidReg reg, uint8_t soc_num, uint32_t thread,
+                                         uint32_t fn, uint32_t extd_fn, uint32_t *value)
+{
+    ApmlTraceRecord record = {reg, soc_num, {thread, fn, extd_fn}};
+    record.start_usec = now_usec();
+    oob_status_t ret = target.cpuid_reg(reg, soc_num, thread, fn, extd_fn, value);
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = *value;
+    }
+    write(record);
+    return ret;
+}
+
+oob_status_t RecordingBackend::threads_per_socket(uint8_t soc_num, uint32_t *value)
+{
+    ApmlTraceRecord record = {APML_THREADS_PER_SOCKET, soc_num};
+    record.start_usec = now_usec();
+    oob_status_t ret = target.threads_per_socket(soc_num, value);
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = *value;
+    }
+    write(record);
+    return ret;
+}
+
+oob_status_t RecordingBackend::threads_per_core(uint8_t soc_num, uint32_t *value)
+{
+    ApmlTraceRecord record = {APML_THREADS_PER_CORE, soc_num};
+    record.start_usec = now_usec();
+    oob_status_t ret = target.threads_per_core(soc_num, value);
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = *value;
+    }
+    write(record);
+    return ret;
+}
+
+oob_status_t RecordingBackend::read_mailbox(uint8_t soc_num, uint32_t cmd, uint32_t arg,
+                                            uint32_t *value)
+{
+    ApmlTraceRecord record = {APML_READ_MAILBOX, soc_num, {cmd, arg, 0}};
+    record.start_usec = now_usec();
+    oob_status_t ret = target.read_mailbox(soc_num, cmd, arg, value);
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = *value;
+    }
+    write(record);
+    return ret;
+}
+
+oob_status_t RecordingBackend::rmi_revision(uint8_t soc_num, uint8_t *rev)
+{
+    ApmlTraceRecord record = {APML_RMI_REVISION, soc_num};
+    record.start_usec = now_usec();
+    oob_status_t ret = target.rmi_revision(soc_num, rev);
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = *rev;
+    }
+    write(record);
+    return ret;
+}
+
+template <typename Call>
+oob_status_t RecordingBackend::record_call(ApmlCall call, uint8_t soc_num, uint32_t a0,
+                                           uint32_t a1, uint32_t *out, Call&& fn)
+{
+    ApmlTraceRecord record = {call, soc_num, {a0, a1, 0}};
+    record.start_usec = now_usec();
+    oob_status_t ret = fn();
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = *out;
+    }
+    write(record);
+    return ret;
+}
+
+oob_status_t RecordingBackend::socket_power(uint8_t soc_num, uint32_t *mw)
+{
+    return record_call(APML_SOCKET_POWER, soc_num, 0, 0, mw,
+                       [&]() { return target.socket_power(soc_num, mw); });
+}
+
+oob_status_t RecordingBackend::socket_power_limit(uint8_t soc_num, uint32_t *mw)
+{
+    return record_call(APML_SOCKET_POWER_LIMIT, soc_num, 0, 0, mw,
+                       [&]() { return target.socket_power_limit(soc_num, mw); });
+}
+
+oob_status_t RecordingBackend::boost_limit(uint8_t soc_num, uint32_t cpu, uint32_t *mhz)
+{
+    return record_call(APML_BOOST_LIMIT, soc_num, cpu, 0, mhz,
+                       [&]() { return target.boost_limit(soc_num, cpu, mhz); });
+}
+
+// the temperature is kept as the bits of the float, replayed exactly
+oob_status_t RecordingBackend::cpu_temp(uint8_t soc_num, float *temp)
+{
+    uint32_t bits = 0;
+    return record_call(APML_CPU_TEMP, soc_num, 0, 0, &bits, [&]() {
+        oob_status_t ret = target.cpu_temp(soc_num, temp);
+        if (ret == OOB_SUCCESS)
+        {
+            memcpy(&bits, temp, sizeof(bits));
+        }
+        return ret;
+    });
+}
+
+void RecordingBackend::pause(unsigned int usec)
+{
+    target.pause(usec);
+}
+
+ReplayBackend::ReplayBackend(const char *path, double time_scale) : time_scale(time_scale)
+{
+    FILE *fp = fopen(path, "r");
+    char line[TRACE_LINE_LEN];
+    size_t count = 0;
+
+    if (fp == NULL)
+    {
+        sd_journal_print(LOG_ERR, "Failed to open APML trace %s : %d \n", path, errno);
+        return;
+    }
+    if (fgets(line, sizeof(line), fp) == NULL ||
+        strncmp(line, APML_TRACE_HEADER, strlen(APML_TRACE_HEADER)))
+    {
+        sd_journal_print(LOG_ERR, "%s is not an APML trace \n", path);
+        fclose(fp);
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        ApmlTraceRecord record = {};
+        char name[32];
+        unsigned int soc_num;
+        unsigned long long start, dur;
+        if (line[0] == '#' ||
+            sscanf(line, "%31s %u %x %x %x %d %x %x %x %x %llu %llu", name, &soc_num,
+                   &record.args[0], &record.args[1], &record.args[2], &record.status,
+                   &record.out[0], &record.out[1], &record.out[2], &record.out[3],
+                   &start, &dur) != 12)
+        {
+            continue;
+        }
+        int call = 0;
+        while (call < APML_CALL_COUNT && strcmp(name, call_names[call]))
+        {
+            call++;
+        }
+        if (call == APML_CALL_COUNT)
+        {
+            continue;
+        }
+        record.call = static_cast<ApmlCall>(call);
+        record.soc_num = soc_num;
+        record.start_usec = start;
+        record.dur_usec = dur;
+        answers[Key(call, soc_num, record.args[0], record.args[1], record.args[2])]
+            .records.push_back(record);
+        count++;
+    }
+    fclose(fp);
+    loaded = true;
+    sd_journal_print(LOG_INFO, "Loaded %zu APML calls from %s \n", count, path);
+}
+
+std::chrono::microseconds ReplayBackend::scaled(uint64_t usec) const
+{
+    return std::chrono::microseconds(static_cast<int64_t>(usec * time_scale));
+}
+
+oob_status_t RecordingBackend::present_gpio(uint8_t soc_num, PresentGpio& gpio, int *value)
+{
+    uint32_t out = 0;
+    return record_call(APML_PRESENT_GPIO, soc_num, 0, 0, &out, [&]() {
+        oob_status_t ret = target.present_gpio(soc_num, gpio, value);
+        if (ret == OOB_SUCCESS)
+        {
+            out = *value;
+        }
+        return ret;
+    });
+}
+
+// the value is kept as its low and high halves in o0 and o1
+oob_status_t RecordingBackend::read_msr(uint8_t soc_num, uint32_t thread, uint32_t msr,
+                                        uint64_t *value)
+{
+    ApmlTraceRecord record = {APML_READ_MSR, soc_num, {thread, msr, 0}};
+    record.start_usec = now_usec();
+    oob_status_t ret = target.read_msr(soc_num, thread, msr, value);
+    record.dur_usec = now_usec() - record.start_usec;
+    record.status = ret;
+    if (ret == OOB_SUCCESS)
+    {
+        record.out[0] = (uint32_t)*value;
+        record.out[1] = (uint32_t)(*value >> 32);
+    }
+    write(record);
+    return ret;
+}
+
+// recorded answer to the next call with these inputs, taking as long as
+// the recorded one did times time_scale. The call starts no earlier than
+// the recorded gap after the end of the previous replayed call on the same
+// socket, the time the service spent in between counts toward the gap.
+oob_status_t ReplayBackend::replay(ApmlCall call, uint8_t soc_num, uint32_t a0, uint32_t a1,
+                                   uint32_t a2, uint32_t *out)
+{
+    ApmlTraceRecord record;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto entry = answers.find(Key(call, soc_num, a0, a1, a2));
+        if (entry == answers.end())
+        {
+            log_ratelimited(LOG_WARNING, "APML trace has no %s call on P%d \n",
+                            call_names[call], soc_num);
+            return OOB_NOT_FOUND;
+        }
+        if (soc_num >= APML_MAX_SOCKETS)
+        {
+            return OOB_NOT_FOUND;
+        }
+        Answers& recorded = entry->second;
+        record = recorded.records[recorded.next];
+        if (recorded.next + 1 < recorded.records.size())
+        {
+            recorded.next++;
+        }
+        // a repeated answer lies behind the previous call, no gap then
+        const Pacing& prev = pacing[soc_num];
+        if (prev.replayed && record.start_usec >= prev.end_usec &&
+            record.start_usec - prev.end_usec <= REPLAY_GAP_MAX_USEC)
+        {
+            start = std::max(start, prev.end + scaled(record.start_usec - prev.end_usec));
+        }
+    }
+    if (time_scale > 0)
+    {
+        std::this_thread::sleep_until(start + scaled(record.dur_usec));
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Pacing& prev = pacing[soc_num];
+        prev.replayed = true;
+        prev.end_usec = record.start_usec + record.dur_usec;
+        prev.end = std::chrono::steady_clock::now();
+    }
+    if (record.status == OOB_SUCCESS)
+    {
+        memcpy(out, record.out, sizeof(record.out));
+    }
+    return static_cast<oob_status_t>(record.status);
+}
+
+oob_status_t ReplayBackend::cpuid(uint8_t soc_num, uint32_t thread, uint32_t *eax,
+                                  uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_CPUID, soc_num, thread, *eax, *ecx, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *eax = out[0];
+        *ebx = out[1];
+        *ecx = out[2];
+        *edx = out[3];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::cpuid_reg(ApmlCpuidReg reg, uint8_t soc_num, uint32_t thread,
+                                      uint32_t fn, uint32_t extd_fn, uint32_t *value)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(reg, soc_num, thread, fn, extd_fn, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *value = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::threads_per_socket(uint8_t soc_num, uint32_t *value)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_THREADS_PER_SOCKET, soc_num, 0, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *value = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::threads_per_core(uint8_t soc_num, uint32_t *value)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_THREADS_PER_CORE, soc_num, 0, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *value = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::read_mailbox(uint8_t soc_num, uint32_t cmd, uint32_t arg,
+                                         uint32_t *value)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_READ_MAILBOX, soc_num, cmd, arg, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *value = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::rmi_revision(uint8_t soc_num, uint8_t *rev)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_RMI_REVISION, soc_num, 0, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *rev = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::socket_power(uint8_t soc_num, uint32_t *mw)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_SOCKET_POWER, soc_num, 0, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *mw = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::socket_power_limit(uint8_t soc_num, uint32_t *mw)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_SOCKET_POWER_LIMIT, soc_num, 0, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *mw = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::boost_limit(uint8_t soc_num, uint32_t cpu, uint32_t *mhz)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_BOOST_LIMIT, soc_num, cpu, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *mhz = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::cpu_temp(uint8_t soc_num, float *temp)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_CPU_TEMP, soc_num, 0, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        memcpy(temp, &out[0], sizeof(*temp));
+    }
+    return ret;
+}
+
+// the line is not touched, the recorded value is returned
+oob_status_t ReplayBackend::present_gpio(uint8_t soc_num, PresentGpio& gpio, int *value)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_PRESENT_GPIO, soc_num, 0, 0, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *value = out[0];
+    }
+    return ret;
+}
+
+oob_status_t ReplayBackend::read_msr(uint8_t soc_num, uint32_t thread, uint32_t msr,
+                                     uint64_t *value)
+{
+    uint32_t out[4];
+    oob_status_t ret = replay(APML_READ_MSR, soc_num, thread, msr, 0, out);
+    if (ret == OOB_SUCCESS)
+    {
+        *value = ((uint64_t)out[1] << 32) | out[0];
+    }
+    return ret;
+}
+
+void ReplayBackend::pause(unsigned int usec)
+{
+    if (time_scale > 0)
+    {
+        std::this_thread::sleep_for(scaled(usec));
+    }
+}
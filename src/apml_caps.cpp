@@ -0,0 +1,132 @@
+#include "apml_caps.hpp"
+
+#include <systemd/sd-journal.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#define CAPS_LINE_LEN   (64)
+
+static_assert(CAP_COUNT == 3, "update the %3s width in load()");
+
+ApmlCapabilities::ApmlCapabilities(const char *path) : path(path)
+{
+    load();
+}
+
+// one line per signature: <cpuid eax> <rmi rev> <support per command>
+// <time of the last unsupported answer>, lines without the time re-probe
+void ApmlCapabilities::load()
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    char line[CAPS_LINE_LEN];
+
+    if (fp == NULL)
+    {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        CapSignature sig;
+        unsigned int eax, rev;
+        char support[CAP_COUNT + 1];
+        long long probed = 0;
+        if (sscanf(line, "%x %x %3s %lld", &eax, &rev, support, &probed) < 3 ||
+            strlen(support) != CAP_COUNT)
+        {
+            continue;
+        }
+        sig.cpuid_eax = eax;
+        sig.rmi_rev = rev;
+        CapEntry& entry = entries[sig];
+        std::copy(support, support + CAP_COUNT, entry.support.begin());
+        entry.probed = probed;
+    }
+    fclose(fp);
+    sd_journal_print(LOG_INFO, "Loaded %zu APML capability entries \n", entries.size());
+}
+
+void ApmlCapabilities::save()
+{
+    std::string tmp = path + ".tmp";
+    FILE *fp;
+
+    if (mkdir(APML_CAPS_DIR, 0755) < 0 && errno != EEXIST)
+    {
+        sd_journal_print(LOG_ERR, "Failed to create %s : %d \n", APML_CAPS_DIR, errno);
+        return;
+    }
+    fp = fopen(tmp.c_str(), "w");
+    if (fp == NULL)
+    {
+        sd_journal_print(LOG_ERR, "Failed to write %s : %d \n", tmp.c_str(), errno);
+        return;
+    }
+    for (const auto& [sig, entry] : entries)
+    {
+        fprintf(fp, "%08x %02x %.*s %lld\n", sig.cpuid_eax, sig.rmi_rev, CAP_COUNT,
+                entry.support.data(), (long long)entry.probed);
+    }
+    if (fclose(fp) != 0 || rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        sd_journal_print(LOG_ERR, "Failed to save %s : %d \n", path.c_str(), errno);
+    }
+}
+
+ApmlSupport ApmlCapabilities::lookup(const CapSignature& sig, ApmlCommand cmd) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto entry = entries.find(sig);
+    if (entry == entries.end())
+    {
+        return CAP_UNKNOWN;
+    }
+    ApmlSupport support = static_cast<ApmlSupport>(entry->second.support[cmd]);
+    if (support == CAP_UNSUPPORTED && expired(entry->second))
+    {
+        return CAP_UNKNOWN;
+    }
+    return support;
+}
+
+// a clock that went backwards, e.g. before NTP on a BMC without RTC, expires too
+bool ApmlCapabilities::expired(const CapEntry& entry)
+{
+    int64_t now = time(nullptr);
+    return now < entry.probed || now - entry.probed >= APML_CAPS_REPROBE_SEC;
+}
+
+void ApmlCapabilities::record(const CapSignature& sig, ApmlCommand cmd, ApmlSupport support)
+{
+    if (support == CAP_UNKNOWN)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    auto entry = entries.find(sig);
+    if (entry == entries.end())
+    {
+        CapEntry unknown;
+        unknown.support.fill(CAP_UNKNOWN);
+        unknown.probed = 0;
+        entry = entries.emplace(sig, unknown).first;
+    }
+    CapEntry& caps = entry->second;
+    if (caps.support[cmd] == support &&
+        (support == CAP_SUPPORTED || !expired(caps)))
+    {
+        return;
+    }
+    caps.support[cmd] = support;
+    if (support == CAP_UNSUPPORTED)
+    {
+        caps.probed = time(nullptr);
+    }
+    sd_journal_print(LOG_INFO, "APML signature %08x/%02x command %d %s \n", sig.cpuid_eax,
+                     sig.rmi_rev, cmd, support == CAP_SUPPORTED ? "supported" : "unsupported");
+    save();
+}
@@ -0,0 +1,214 @@
+#include "cpu_info.hpp"
+#include "cpu_log.hpp"
+
+#include <cstring>
+
+#define USEC_PER_SEC        (1000000ULL)
+#define USEC_PER_MSEC       (1000ULL)
+#define PROGRESS_STAGES     "xyz.openbmc_project.State.Boot.Progress.ProgressStages."
+
+// Any stage past Unspecified, OEM stages included, means host firmware runs
+static bool boot_progress_started(const std::string& stage)
+{
+    return stage.compare(0, strlen(PROGRESS_STAGES), PROGRESS_STAGES) == 0 &&
+           stage.compare(strlen(PROGRESS_STAGES), std::string::npos, "Unspecified") != 0;
+}
+
+// BootProgress of the host, false when it is not published
+bool CpuInfo::read_boot_progress(bool& started)
+{
+    std::string path = CpuInfoDataHolder::HostStatePathPrefix + std::to_string(host_num);
+    std::string service = "xyz.openbmc_project.State.Host" + std::to_string(host_num);
+
+    try
+    {
+        auto method = bus.new_method_call(service.c_str(), path.c_str(),
+                                          CpuInfoDataHolder::PropertiesIntf, "Get");
+        method.append(BOOT_PROGRESS_INTF, "BootProgress");
+        auto reply = bus.call(method);
+        std::variant<std::string> stage;
+        reply.read(stage);
+        started = boot_progress_started(std::get<std::string>(stage));
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        sd_journal_print(LOG_INFO, "host%d boot progress not available : %s \n", host_num, e.what());
+    }
+    return false;
+}
+
+void CpuInfo::on_boot_progress(sdbusplus::message::message &msg)
+{
+    std::string objectName;
+    std::map<std::string, std::variant<std::string, uint64_t>> msgData;
+    msg.read(objectName, msgData);
+
+    auto stage = msgData.find("BootProgress");
+    if (stage == msgData.end())
+    {
+        return;
+    }
+    const std::string *value = std::get_if<std::string>(&stage->second);
+    boot_progress(value && boot_progress_started(*value));
+}
+
+// A stage past Unspecified or a POST code: the CPU runs firmware, probe it.
+// A stale stage or a late POST code while the host is off is ignored.
+void CpuInfo::boot_progress(bool started)
+{
+    boot_signals = true;
+    if (!started || !host_running || boot_gate == BOOT_PROBING || boot_gate == BOOT_OPEN)
+    {
+        return;
+    }
+    begin_measure();
+    start_probe();
+}
+
+// CurrentHostState left Off, or the host runs at startup
+void CpuInfo::boot_host_on()
+{
+    host_running = true;
+    begin_measure();
+    if (boot_gate == BOOT_OPEN)
+    {
+        start_collection();
+        return;
+    }
+    if (boot_gate != BOOT_IDLE)
+    {
+        return;
+    }
+    // no boot progress on this platform, collect right away as before
+    if (!boot_signals || !arm_boot_timer(BOOT_PROGRESS_WAIT_SEC * USEC_PER_SEC))
+    {
+        open_boot_gate("host on");
+        return;
+    }
+    boot_gate = BOOT_WAITING;
+    if (notifier)
+    {
+        notifier->status("host%d waiting for boot progress", host_num);
+    }
+}
+
+void CpuInfo::boot_host_off()
+{
+    host_running = false;
+    boot_gate = BOOT_IDLE;
+    if (boot_timer)
+    {
+        sd_event_source_set_enabled(boot_timer, SD_EVENT_OFF);
+    }
+}
+
+void CpuInfo::open_boot_gate(const char *reason)
+{
+    sd_journal_print(LOG_INFO, "host%d collecting, %s \n", host_num, reason);
+    boot_gate = BOOT_OPEN;
+    if (boot_timer)
+    {
+        sd_event_source_set_enabled(boot_timer, SD_EVENT_OFF);
+    }
+    start_collection();
+}
+
+void CpuInfo::start_probe()
+{
+    if (boot_gate != BOOT_PROBING)
+    {
+        boot_gate = BOOT_PROBING;
+        probe_deadline = std::chrono::steady_clock::now() +
+                         std::chrono::seconds(BOOT_PROBE_TIMEOUT_SEC);
+        if (notifier)
+        {
+            notifier->status("host%d probing APML", host_num);
+        }
+    }
+
+    // CPUID leaf 1 is served by the SMU, one cheap read per socket tells
+    // whether the collection can get answers
+    pool.post([this]() {
+        bool ready = false;
+        for (uint8_t soc_num = get_first_socket();
+             soc_num < get_first_socket() + MAX_SOCKETS_PER_HOST && !ready; soc_num++)
+        {
+            uint32_t eax = 1, ebx = 0, ecx = 0, edx = 0;
+            ready = apml->cpuid(apml_socket(soc_num), 0, &eax, &ebx, &ecx, &edx) == OOB_SUCCESS;
+        }
+        pool.post_to_loop([this, ready]() {
+            probe_done(ready);
+        });
+    }, host_num);
+}
+
+void CpuInfo::probe_done(bool ready)
+{
+    // host went off while probing
+    if (boot_gate != BOOT_PROBING)
+    {
+        return;
+    }
+    if (ready)
+    {
+        open_boot_gate("APML answers");
+    }
+    else if (std::chrono::steady_clock::now() >= probe_deadline)
+    {
+        open_boot_gate("APML probe timed out");
+    }
+    else if (!arm_boot_timer(BOOT_PROBE_INTERVAL_MS * USEC_PER_MSEC))
+    {
+        open_boot_gate("no probe timer");
+    }
+}
+
+// one timer per host, the boot progress wait or the next probe
+bool CpuInfo::arm_boot_timer(uint64_t usec)
+{
+    uint64_t now;
+    int ret;
+
+    if (event == nullptr)
+    {
+        return false;
+    }
+    sd_event_now(event, CLOCK_MONOTONIC, &now);
+    if (boot_timer == nullptr)
+    {
+        ret = sd_event_add_time(event, &boot_timer, CLOCK_MONOTONIC, now + usec, 0,
+                                on_boot_timer, this);
+    }
+    else
+    {
+        ret = sd_event_source_set_time(boot_timer, now + usec);
+        if (ret >= 0)
+        {
+            ret = sd_event_source_set_enabled(boot_timer, SD_EVENT_ONESHOT);
+        }
+    }
+    if (ret < 0)
+    {
+        log_ratelimited(LOG_ERR, "Failed to arm the boot timer : %d \n", ret);
+        return false;
+    }
+    return true;
+}
+
+int CpuInfo::on_boot_timer(sd_event_source *source, uint64_t usec, void *userdata)
+{
+    CpuInfo *self = static_cast<CpuInfo *>(userdata);
+
+    if (self->boot_gate == BOOT_WAITING)
+    {
+        // no signal this boot, the next one does not wait for it
+        self->boot_signals = false;
+        self->open_boot_gate("no boot progress");
+    }
+    else if (self->boot_gate == BOOT_PROBING)
+    {
+        self->start_probe();
+    }
+    return 0;
+}
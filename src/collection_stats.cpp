@@ -0,0 +1,207 @@
+#include "collection_stats.hpp"
+
+#include <systemd/sd-journal.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#define STATUS_FILE   "/proc/self/status"
+#define STATUS_LINE   (128)
+// "5" resets VmHWM to the current RSS
+#define CLEAR_REFS_FILE  "/proc/self/clear_refs"
+
+const sd_bus_vtable CollectionStats::vtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::property("HostStateSignals", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("Collections", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("CoalescedTriggers", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("SetsIssued", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("SetsFailed", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("InventorySamples", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("TimeToInventoryP50Usec", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("TimeToInventoryP99Usec", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("PeakRssKiB", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("Jobs", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("JobQueueDepthMax", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("JobWaitAvgUsec", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("JobWaitMaxUsec", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("Completions", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("CompletionQueueDepthMax", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("CompletionWaitAvgUsec", "t", CollectionStats::get_property),
+    sdbusplus::vtable::property("CompletionWaitMaxUsec", "t", CollectionStats::get_property),
+#ifdef ENABLE_TESTS
+    // clears VmHWM of the process, test builds only
+    sdbusplus::vtable::method("Reset", "", "", CollectionStats::reset),
+#endif
+    sdbusplus::vtable::end()};
+
+CollectionStats::CollectionStats(sdbusplus::bus::bus &bus) :
+    intf(bus, DBUS_OBJECT_NAME, SERVICE_STATS_INTF, vtable, this)
+{
+}
+
+void CollectionStats::host_signal()
+{
+    host_signals++;
+}
+
+void CollectionStats::collection_started()
+{
+    collections++;
+}
+
+void CollectionStats::coalesced()
+{
+    coalesced_triggers++;
+}
+
+void CollectionStats::set_issued()
+{
+    sets_issued++;
+}
+
+void CollectionStats::set_failed()
+{
+    sets_failed++;
+}
+
+void CollectionStats::inventory_done(std::chrono::steady_clock::duration elapsed)
+{
+    inventory_usec[samples % STATS_SAMPLES] =
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    samples++;
+}
+
+// nearest rank over the last STATS_SAMPLES samples
+uint64_t CollectionStats::percentile(unsigned int pct) const
+{
+    uint64_t sorted[STATS_SAMPLES];
+    size_t count = std::min<uint64_t>(samples, STATS_SAMPLES);
+
+    if (count == 0)
+    {
+        return 0;
+    }
+    std::copy(inventory_usec, inventory_usec + count, sorted);
+    size_t rank = (count * pct + 99) / 100;
+    std::nth_element(sorted, sorted + rank - 1, sorted + count);
+    return sorted[rank - 1];
+}
+
+// VmHWM, the peak resident set of the process
+static uint64_t peak_rss_kib()
+{
+    char line[STATUS_LINE];
+    unsigned long long kib = 0;
+    FILE *fp = fopen(STATUS_FILE, "r");
+
+    if (!fp)
+    {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "VmHWM: %llu kB", &kib) == 1)
+        {
+            break;
+        }
+    }
+    fclose(fp);
+    return kib;
+}
+
+#ifdef ENABLE_TESTS
+static void reset_peak_rss()
+{
+    FILE *fp = fopen(CLEAR_REFS_FILE, "w");
+
+    if (!fp)
+    {
+        sd_journal_print(LOG_WARNING, "Failed to open %s, PeakRssKiB not reset \n", CLEAR_REFS_FILE);
+        return;
+    }
+    // the write reaches the kernel on fclose
+    bool ok = fputs("5", fp) >= 0;
+    if (fclose(fp) != 0 || !ok)
+    {
+        sd_journal_print(LOG_WARNING, "Failed to write %s, PeakRssKiB not reset \n", CLEAR_REFS_FILE);
+    }
+}
+#endif
+
+int CollectionStats::get_property(sd_bus *bus, const char *path, const char *interface,
+                                  const char *property, sd_bus_message *reply,
+                                  void *userdata, sd_bus_error *error)
+{
+    const CollectionStats *self = static_cast<CollectionStats *>(userdata);
+    static const struct
+    {
+        const char *name;
+        uint64_t CollectionStats::*counter;
+    } counters[] = {
+        {"HostStateSignals", &CollectionStats::host_signals},
+        {"Collections", &CollectionStats::collections},
+        {"CoalescedTriggers", &CollectionStats::coalesced_triggers},
+        {"SetsIssued", &CollectionStats::sets_issued},
+        {"SetsFailed", &CollectionStats::sets_failed},
+        {"InventorySamples", &CollectionStats::samples},
+    };
+    uint64_t value;
+
+    for (const auto& counter : counters)
+    {
+        if (!strcmp(property, counter.name))
+            return sd_bus_message_append(reply, "t", self->*counter.counter);
+    }
+    WorkerPoolStats queues = self->pool ? self->pool->stats() : WorkerPoolStats{};
+    const struct
+    {
+        const char *name;
+        uint64_t value;
+    } queue_figures[] = {
+        {"Jobs", queues.jobs},
+        {"JobQueueDepthMax", queues.job_depth_max},
+        {"JobWaitAvgUsec", queues.jobs ? queues.job_wait_total_usec / queues.jobs : 0},
+        {"JobWaitMaxUsec", queues.job_wait_max_usec},
+        {"Completions", queues.completions},
+        {"CompletionQueueDepthMax", queues.completion_depth_max},
+        {"CompletionWaitAvgUsec",
+         queues.completions ? queues.completion_wait_total_usec / queues.completions : 0},
+        {"CompletionWaitMaxUsec", queues.completion_wait_max_usec},
+    };
+    for (const auto& figure : queue_figures)
+    {
+        if (!strcmp(property, figure.name))
+            return sd_bus_message_append(reply, "t", figure.value);
+    }
+
+    if (!strcmp(property, "TimeToInventoryP50Usec"))
+        value = self->percentile(50);
+    else if (!strcmp(property, "TimeToInventoryP99Usec"))
+        value = self->percentile(99);
+    else
+        value = peak_rss_kib();
+    return sd_bus_message_append(reply, "t", value);
+}
+
+#ifdef ENABLE_TESTS
+// start a new baseline, e.g. before a scripted power cycle storm
+int CollectionStats::reset(sd_bus_message *msg, void *userdata, sd_bus_error *error)
+{
+    CollectionStats *self = static_cast<CollectionStats *>(userdata);
+
+    self->host_signals = 0;
+    self->collections = 0;
+    self->coalesced_triggers = 0;
+    self->sets_issued = 0;
+    self->sets_failed = 0;
+    self->samples = 0;
+    if (self->pool)
+    {
+        self->pool->reset_stats();
+    }
+    reset_peak_rss();
+    return sd_bus_reply_method_return(msg, "");
+}
+#endif
@@ -0,0 +1,185 @@
+#include "core_map.hpp"
+#include "cpu_info.hpp"
+#include "cpu_log.hpp"
+
+#include <systemd/sd-journal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+#define CPUID_Fn8000001E      (0x8000001E)
+#define MSR_PATCH_LEVEL       (0x0000008B)
+
+// Accumulates the bus time of the APML calls made through it
+class BusTimer
+{
+  public:
+    explicit BusTimer(uint64_t& total) : total(total), begin(std::chrono::steady_clock::now())
+    {
+    }
+    ~BusTimer()
+    {
+        total += std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - begin).count();
+    }
+
+  private:
+    uint64_t& total;
+    std::chrono::steady_clock::time_point begin;
+};
+
+static bool read_apic_id(ApmlBackend& apml, uint8_t soc_num, uint32_t thread, CoreMap& map)
+{
+    uint32_t eax = CPUID_Fn8000001E;
+    uint32_t ebx = 0;
+    uint32_t ecx = 0;
+    uint32_t edx = 0;
+    oob_status_t ret;
+    {
+        BusTimer timer(map.bus_usec);
+        ret = apml.cpuid(soc_num, thread, &eax, &ebx, &ecx, &edx);
+    }
+    // a disabled thread does not answer the CPUID request
+    map.apic_ids[thread] = (ret == OOB_SUCCESS) ? eax : CORE_MAP_DISABLED;
+    return ret == OOB_SUCCESS;
+}
+
+static void read_core_ucode(ApmlBackend& apml, uint8_t soc_num, uint32_t core, CoreMap& map)
+{
+    uint64_t patch_level = 0;
+    oob_status_t ret;
+    {
+        BusTimer timer(map.bus_usec);
+        ret = apml.read_msr(soc_num, core, MSR_PATCH_LEVEL, &patch_level);
+    }
+    map.core_ucode[core] = (ret == OOB_SUCCESS) ? (uint32_t)patch_level : CORE_MAP_DISABLED;
+}
+
+bool enumerate_cores(ApmlBackend& apml, uint8_t soc_num, uint8_t apml_socket,
+                     uint64_t budget_usec, CoreMap& map)
+{
+    uint32_t threads_per_soc = 0;
+    uint32_t threads_per_core = 0;
+
+    // background work, keep out of the way of the inventory collection
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), CORE_MAP_NICE);
+
+    map = CoreMap();
+    map.soc_num = soc_num;
+    {
+        BusTimer timer(map.bus_usec);
+        if (apml.threads_per_socket(apml_socket, &threads_per_soc) ||
+            apml.threads_per_core(apml_socket, &threads_per_core) ||
+            threads_per_core == 0 || threads_per_soc < threads_per_core)
+        {
+            log_ratelimited(LOG_ERR, "P%d core map: failed to read thread topology \n", soc_num);
+            return false;
+        }
+    }
+
+    uint32_t num_cores = threads_per_soc / threads_per_core;
+    map.threads_per_core = threads_per_core;
+    map.apic_ids.assign(threads_per_soc, CORE_MAP_DISABLED);
+    map.core_ucode.assign(num_cores, CORE_MAP_DISABLED);
+
+    // primary threads first, an enabled core also gets its microcode read
+    uint32_t thread = 0;
+    for (; thread < threads_per_soc && map.bus_usec < budget_usec; thread++)
+    {
+        uint32_t core = thread % num_cores;
+        bool primary = thread < num_cores;
+        if (!primary && map.apic_ids[core] == CORE_MAP_DISABLED)
+        {
+            // sibling of a disabled core, nothing to ask the bus for
+            continue;
+        }
+        if (read_apic_id(apml, apml_socket, thread, map) && primary)
+        {
+            read_core_ucode(apml, apml_socket, core, map);
+        }
+    }
+    map.complete = (thread == threads_per_soc);
+
+    uint32_t reference = CORE_MAP_DISABLED;
+    for (uint32_t core = 0; core < num_cores; core++)
+    {
+        uint32_t ucode = map.core_ucode[core];
+        if (map.apic_ids[core] != CORE_MAP_DISABLED)
+            map.enabled_cores++;
+        if (ucode == CORE_MAP_DISABLED)
+            continue;
+        if (reference == CORE_MAP_DISABLED)
+            reference = ucode;
+        else if (ucode != reference)
+            map.ucode_consistent = false;
+    }
+
+    sd_journal_print(LOG_INFO, "P%d core map: %u of %u cores enabled, %s, bus time %llu us \n",
+                     soc_num, map.enabled_cores, num_cores,
+                     map.complete ? "complete" : "budget exhausted",
+                     (unsigned long long)map.bus_usec);
+    return true;
+}
+
+const sd_bus_vtable CoreMapObject::vtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::property("ThreadsPerCore", "u", CoreMapObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("ApicIds", "au", CoreMapObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("CoreMicrocode", "au", CoreMapObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("EnabledCoreCount", "u", CoreMapObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("MicrocodeConsistent", "b", CoreMapObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("Complete", "b", CoreMapObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("BusTimeUsec", "t", CoreMapObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::end()};
+
+CoreMapObject::CoreMapObject(sdbusplus::bus::bus &bus, uint8_t soc_num) :
+    path(std::string(DBUS_OBJECT_NAME) + "/P" + std::to_string(soc_num)),
+    intf(bus, path.c_str(), CORE_MAP_INTF, vtable, this)
+{
+    map.soc_num = soc_num;
+}
+
+void CoreMapObject::update(CoreMap&& new_map)
+{
+    static const char *properties[] = {"ThreadsPerCore", "ApicIds", "CoreMicrocode",
+        "EnabledCoreCount", "MicrocodeConsistent", "Complete", "BusTimeUsec"};
+
+    map = std::move(new_map);
+    for (const char *property : properties)
+    {
+        intf.property_changed(property);
+    }
+}
+
+int CoreMapObject::get_property(sd_bus *bus, const char *path, const char *interface,
+                                const char *property, sd_bus_message *reply,
+                                void *userdata, sd_bus_error *error)
+{
+    const CoreMap& map = static_cast<CoreMapObject *>(userdata)->map;
+
+    if (!strcmp(property, "ThreadsPerCore"))
+        return sd_bus_message_append(reply, "u", map.threads_per_core);
+    if (!strcmp(property, "ApicIds"))
+        return sd_bus_message_append_array(reply, 'u', map.apic_ids.data(),
+                                           map.apic_ids.size() * sizeof(uint32_t));
+    if (!strcmp(property, "CoreMicrocode"))
+        return sd_bus_message_append_array(reply, 'u', map.core_ucode.data(),
+                                           map.core_ucode.size() * sizeof(uint32_t));
+    if (!strcmp(property, "EnabledCoreCount"))
+        return sd_bus_message_append(reply, "u", map.enabled_cores);
+    if (!strcmp(property, "MicrocodeConsistent"))
+        return sd_bus_message_append(reply, "b", (int)map.ucode_consistent);
+    if (!strcmp(property, "Complete"))
+        return sd_bus_message_append(reply, "b", (int)map.complete);
+    return sd_bus_message_append(reply, "t", (uint64_t)map.bus_usec);
+}
@@ -0,0 +1,596 @@
+#include "cpu_collector.hpp"
+#include "cpu_decode.hpp"
+#include "cpu_log.hpp"
+
+#include <systemd/sd-journal.h>
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+extern "C" {
+#include <unistd.h>
+#include "linux/i2c-dev.h"
+#include "i2c/smbus.h"
+#include "apml64Config.h"
+#include "esmi_cpuid_msr.h"
+#include "apml.h"
+#include "esmi_mailbox.h"
+#include "esmi_rmi.h"
+#include "esmi_cpuid_msr.h"
+#include "esmi_tsi.h"
+#include "esmi_mailbox_nda.h"
+}
+
+#define MAX_RETRY           20
+
+#define CMD_BUFF_LEN     256
+#define FNAME_LEN        128
+
+// AMPL command
+#define EAX_VAL 1
+#define EAX_DATA_LEN_1 4
+#define EAX_DATA_LEN_2 8
+#define EAX_DATA_LEN_3 16
+#define EAX_DATA_LEN_4 20
+#define EAX_MASK_MAGIC_1 0xf
+#define EAX_MASK_MAGIC_2 0xff
+#define EAX_MASK_MAGIC_3 0x10
+#define APML_SLEEP 10000
+#define MUX_SLEEP_USEC (5 * 1000000)
+
+#define DBUS_Present  "Present"
+
+// Init CPU Information using OOB library
+void CpuCollector::collect_cpu_information()
+{
+  uint8_t first_soc = get_first_socket();
+
+  if (num_of_proc > MAX_SOCKETS_PER_HOST)
+  {
+     num_of_proc = MAX_SOCKETS_PER_HOST;
+  }
+  collected = num_of_proc;
+  for(uint8_t soc_num = first_soc; soc_num < first_soc + num_of_proc;  soc_num++)
+  {
+     collect_socket(soc_num);
+  }
+
+}
+
+static uint64_t elapsed_usec(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - begin).count();
+}
+
+void CpuCollector::collect_socket(uint8_t soc_num)
+{
+    static const struct
+    {
+        const char *name;
+        void (CpuCollector::*fn)(uint8_t);
+        // expensive steps are left to collect_lazy in lazy mode
+        bool deferrable;
+    } steps[] = {
+        {"BaseFrequency", &CpuCollector::get_cpu_base_freq, false},
+        {"PPIN", &CpuCollector::get_ppin_fuse, true},
+        {"Threads", &CpuCollector::get_threads_per_core_and_soc, false},
+        {"Microcode", &CpuCollector::get_microcode_rev, false},
+        {"OPN", &CpuCollector::get_opn, true},
+    };
+    CollectSummary summary = {};
+    size_t first_field = pending.size();
+    size_t first_timing = timings.size();
+    auto start = std::chrono::steady_clock::now();
+
+    on_step(soc_num, "FamilyModelStep");
+    auto begin = std::chrono::steady_clock::now();
+    unsigned int errors = step_errors;
+    bool answered = connect_apml_get_family_model_step(soc_num);
+    timings.push_back({soc_num, "FamilyModelStep", elapsed_usec(begin)});
+    if (!answered || step_errors != errors)
+    {
+        summary.failed(timings.back().step);
+    }
+    if (answered)
+    {
+        present.push_back(soc_num);
+
+        set_general_info(soc_num);
+        for (const auto& step : steps)
+        {
+            if (lazy && step.deferrable)
+            {
+                continue;
+            }
+            on_step(soc_num, step.name);
+            begin = std::chrono::steady_clock::now();
+            errors = step_errors;
+            (this->*step.fn)(soc_num);
+            timings.push_back({soc_num, step.name, elapsed_usec(begin)});
+            if (step_errors != errors)
+            {
+                summary.failed(step.name);
+            }
+        }
+    }
+    log_summary(soc_num, answered, pending.size() - first_field, summary,
+                first_timing, elapsed_usec(start));
+}
+
+// read one deferred step of a socket that answered the last collection
+bool CpuCollector::collect_lazy(uint8_t soc_num, LazyStep step)
+{
+    static const char *names[LAZY_STEP_COUNT] = {"PPIN", "OPN"};
+    CollectSummary summary = {};
+    size_t first_field = pending.size();
+    size_t first_timing = timings.size();
+    unsigned int errors = step_errors;
+
+    on_step(soc_num, names[step]);
+    auto begin = std::chrono::steady_clock::now();
+    if (step == LAZY_PPIN)
+    {
+        get_ppin_fuse(soc_num);
+    }
+    else
+    {
+        get_opn(soc_num);
+    }
+    timings.push_back({soc_num, names[step], elapsed_usec(begin)});
+    if (step_errors != errors)
+    {
+        summary.failed(names[step]);
+    }
+    log_summary(soc_num, true, pending.size() - first_field, summary,
+                first_timing, timings.back().usec);
+    return summary.failures == 0;
+}
+
+void CollectSummary::failed(const char *step)
+{
+    int len = strlen(failed_steps);
+    snprintf(failed_steps + len, sizeof(failed_steps) - len, "%s%s", len ? "," : "", step);
+    failures++;
+}
+
+// one journal record per socket and collection instead of a line per operation
+void CpuCollector::log_summary(uint8_t soc_num, bool answered, size_t fields,
+                               const CollectSummary& summary, size_t first_timing,
+                               uint64_t usec)
+{
+    char step_usec[SUMMARY_LEN] = {0};
+    int len = 0;
+
+    for (size_t i = first_timing; i < timings.size() && len < (int)sizeof(step_usec); i++)
+    {
+        len += snprintf(step_usec + len, sizeof(step_usec) - len, "%s%s=%llu",
+                        len ? "," : "", timings[i].step, (unsigned long long)timings[i].usec);
+    }
+    sd_journal_send("MESSAGE=P%d %s: %zu fields, %u failed steps%s%s, %llu us", soc_num,
+                    answered ? "collected" : "absent", fields, summary.failures,
+                    summary.failures ? " " : "", summary.failed_steps,
+                    (unsigned long long)usec,
+                    "PRIORITY=%d", summary.failures ? LOG_WARNING : LOG_INFO,
+                    "CPU_SOCKET=%d", soc_num,
+                    "CPU_PRESENT=%d", answered ? 1 : 0,
+                    "CPU_FIELDS=%zu", fields,
+                    "CPU_FAILED_STEPS=%s", summary.failed_steps,
+                    "CPU_STEP_USEC=%s", step_usec,
+                    "CPU_DURATION_USEC=%llu", (unsigned long long)usec,
+                    NULL);
+}
+
+// errors of a collection step, counted for the summary and rate limited
+void CpuCollector::collect_error(const char *fmt, ...)
+{
+    va_list args;
+
+    step_errors++;
+    va_start(args, fmt);
+    log_ratelimited_v(LOG_ERR, fmt, args);
+    va_end(args);
+}
+
+// -1 when the presence line of the socket is missing or unreadable
+int CpuCollector::getGPIOValue(uint8_t soc_num)
+{
+    int value;
+
+    if (apml->present_gpio(apml_socket(soc_num), present_gpios[socket_index(soc_num)],
+                           &value) != OOB_SUCCESS)
+    {
+        return -1;
+    }
+    return value;
+}
+//Call Apml library to get the CPU Info
+bool CpuCollector::connect_apml_get_family_model_step(uint8_t soc_num )
+{
+    int retry = 0;
+    oob_status_t ret;
+    uint32_t family_id;
+    uint32_t model_id;
+    uint32_t step_id;
+    uint32_t ext_family;
+    uint32_t ext_model;
+    int core_id = 0;
+    uint16_t cpuPresence;
+    uint32_t ebx = 0;
+    uint32_t edx = 0;
+    uint32_t eax = EAX_VAL;
+    uint32_t ecx = 0;
+    try
+    {
+      while(retry < MAX_RETRY)
+      {
+        ret = apml->cpuid(apml_socket(soc_num), core_id, &eax, &ebx, &ecx, &edx);
+        if(ret != 0)
+        {
+          apml->pause(MUX_SLEEP_USEC);
+          retry++;
+        }
+        else
+        {
+          break;
+        }
+      }//end of retry
+
+      cpuPresence = getGPIOValue(soc_num);
+      if (cpuPresence == 1)
+      {
+         //set false -Absent if GPIO value is high -default is true
+         set_cpu_bool_value(soc_num, false, DBUS_Present, CPU_INTERFACE);
+         CPU_INFO_DEBUG("Warning : %d CPU is absent \n", soc_num);
+         return false;
+      }
+
+      if(ret != 0)
+      {
+        collect_error("Error : Unable to get the CPU info from APML \n" );
+      }
+      else
+      {
+        CapSignature& sig = signatures[socket_index(soc_num)];
+        sig.cpuid_eax = eax;
+        sig.rmi_rev = 0;
+        if (apml->rmi_revision(apml_socket(soc_num), &sig.rmi_rev) != OOB_SUCCESS)
+        {
+          collect_error("Failed to read SB-RMI revision \n");
+        }
+
+        char cpuid[PROP_STR_LEN];
+
+        ext_family = ((eax >> EAX_DATA_LEN_4) & EAX_MASK_MAGIC_2);
+        snprintf(cpuid, sizeof(cpuid), "%x (%d)", ext_family, ext_family);
+        set_cpu_string_value(soc_num, cpuid, "EffectiveFamily", CPU_INTERFACE);
+
+        family_id = ((eax >> EAX_DATA_LEN_2) & EAX_MASK_MAGIC_1) + ext_family;
+        snprintf(cpuid, sizeof(cpuid), "%x (%d)", family_id, family_id);
+        set_cpu_string_value(soc_num, cpuid, "Family", CPU_INTERFACE);
+
+        ext_model = ((eax >> EAX_DATA_LEN_3) & EAX_MASK_MAGIC_1);
+        snprintf(cpuid, sizeof(cpuid), "%x (%d)", ext_model, ext_model);
+        set_cpu_string_value(soc_num, cpuid, "EffectiveModel", CPU_INTERFACE);
+
+        model_id = ext_model * EAX_MASK_MAGIC_3 + ((eax >> EAX_DATA_LEN_1) & EAX_MASK_MAGIC_1);
+        snprintf(cpuid, sizeof(cpuid), "%x (%d)", model_id, model_id);
+        set_cpu_string_value(soc_num, cpuid, "Model", CPU_INTERFACE);
+
+        step_id = eax & EAX_MASK_MAGIC_1 ;
+        snprintf(cpuid, sizeof(cpuid), "%x (%d)", step_id, step_id);
+        set_cpu_string_value(soc_num, cpuid, "Step", CPU_INTERFACE);
+
+        snprintf(cpuid, sizeof(cpuid), "%d", soc_num - get_first_socket());
+        set_cpu_string_value(soc_num, cpuid, "Socket", CPU_INTERFACE);
+
+        return true;
+      }
+    }
+    catch (std::exception& e)
+    {
+       collect_error("Error getting CPU Model, Family and Step value \n");
+       return false;
+    }
+
+    return false;
+}
+// Get the OPN
+void CpuCollector::get_opn(uint8_t soc_num)
+{
+    static const uint32_t opn_leaf[OPN_LEAF_COUNT] = {CPUID_Fn8000002, CPUID_Fn8000003, CPUID_Fn8000004};
+    uint32_t cpuid_extd_fn = 0;
+    uint32_t thread_ind = 0;
+    uint32_t regs[OPN_LEAF_COUNT][OPN_REG_COUNT] = {{0}};
+    char opn[OPN_BUFF_LEN];
+
+    for (int leaf = 0; leaf < OPN_LEAF_COUNT; leaf++)
+    {
+        if (!read_register(soc_num, thread_ind, opn_leaf[leaf], cpuid_extd_fn,
+                           &regs[leaf][0], &regs[leaf][1], &regs[leaf][2], &regs[leaf][3]))
+        {
+            collect_error("Failed to read 0x%x register value \n", opn_leaf[leaf]);
+            return;
+        }
+    }
+
+    //convert register bytes to ascii opn string
+    decode_opn(regs, opn);
+    CPU_INFO_DEBUG("OPN string # %s \n", opn);
+
+    //set the value in DBUS
+    set_cpu_string_value(soc_num, opn, PARTNUMBER, ASSET_INTERFACE);
+
+}
+// Read register thru apml lib
+bool CpuCollector::read_register(uint8_t soc_num, uint32_t thread_ind, uint32_t cpuid_fn, uint32_t cpuid_extd_fn, uint32_t *eax_value, uint32_t *ebx_value, uint32_t *ecx_value, uint32_t *edx_value)
+{
+    bool ret = false;
+    if(OOB_SUCCESS == apml->cpuid_reg(APML_CPUID_EAX, apml_socket(soc_num), thread_ind, cpuid_fn, cpuid_extd_fn, eax_value))
+    {
+       if(OOB_SUCCESS == apml->cpuid_reg(APML_CPUID_EBX, apml_socket(soc_num), thread_ind, cpuid_fn, cpuid_extd_fn, ebx_value))
+       {
+          if(OOB_SUCCESS == apml->cpuid_reg(APML_CPUID_ECX, apml_socket(soc_num), thread_ind, cpuid_fn, cpuid_extd_fn, ecx_value))
+          {
+             if(OOB_SUCCESS == apml->cpuid_reg(APML_CPUID_EDX, apml_socket(soc_num), thread_ind, cpuid_fn, cpuid_extd_fn, edx_value))
+             {
+                ret = true;
+             }
+             else
+             {
+                collect_error("Error reading register eax \n");
+             }
+          }
+          else
+          {
+             collect_error("Error reading register ecx \n");
+          }
+       }
+       else
+       {
+          collect_error("Error reading register ebx \n");
+       }
+    }
+    else
+    {
+       collect_error("Error reading register eax \n");
+    }
+
+    return ret;
+}
+void CpuCollector::set_general_info(uint8_t soc_num)
+{
+    set_cpu_string_value(soc_num, "AMD", "Manufacturer", ASSET_INTERFACE);
+    set_cpu_string_value(soc_num, "AuthenticAMD", "VendorId", CPU_INTERFACE);
+
+}
+//Get processor threads per Core and Socket
+void CpuCollector::get_threads_per_core_and_soc(uint8_t soc_num)
+{
+    uint32_t threads_per_core, threads_per_soc;
+    bool isthreadcall_pass = false;
+    oob_status_t ret;
+    try
+    {
+      ret = apml->threads_per_socket(apml_socket(soc_num), &threads_per_soc);
+      if (ret)
+      {
+        collect_error("esmi_get_threads_per_socket call failed \n");
+      }
+      else
+      {
+        set_cpu_int16_value(soc_num, threads_per_soc, "ThreadCount", CPU_INTERFACE);
+        isthreadcall_pass = true;
+      }
+      apml->pause(APML_SLEEP);
+
+      ret = apml->threads_per_core(apml_socket(soc_num), &threads_per_core);
+      if (ret)
+      {
+        collect_error("esmi_get_threads_per_core call failed \n");
+      }
+      else
+      {
+        if(isthreadcall_pass)
+        {
+          uint32_t TotalCores = threads_per_soc / threads_per_core;
+          set_cpu_int16_value(soc_num, TotalCores, "CoreCount", CPU_INTERFACE);
+        }
+      }
+    }
+    catch (std::exception& e)
+    {
+       collect_error("Error getting Thread and Socket \n");
+       return ;
+    }
+}
+
+void CpuCollector::get_cpu_base_freq(uint8_t soc_num)
+{
+    uint32_t  buffer, value;
+    oob_status_t ret;
+    try
+    {
+       if (!cmd_supported(soc_num, CAP_BASE_FREQ))
+       {
+            return;
+       }
+       ret = apml->read_mailbox(apml_socket(soc_num), READ_BMC_CPU_BASE_FREQUENCY, 0, &buffer);
+       cmd_result(soc_num, CAP_BASE_FREQ, ret);
+       if (ret != OOB_SUCCESS) {
+            collect_error("read bmc cpu base freq failed \n");
+            return;
+       }
+     }
+     catch (std::exception& e)
+     {
+        collect_error("Error getting CPU Base Freq value \n");
+        return ;
+     }
+     set_cpu_int_value(soc_num, buffer, "MaxSpeedInMhz", CPU_INTERFACE);
+}
+//Get PPIN then we need to Decode to get Serial Number
+void CpuCollector::get_ppin_fuse(uint8_t soc_num)
+{
+    uint32_t buffer = 0;
+    oob_status_t ret;
+    uint64_t data = 0;
+    char cpuid[CMD_BUFF_LEN];
+    int retry = 0;
+    if (!cmd_supported(soc_num, CAP_PPIN))
+    {
+        return;
+    }
+    //APML read mail box takes time to init, hence added retry
+    try
+    {
+      while(retry < MAX_RETRY)
+      {
+        // Read lower 32 bit PPIN data$
+        ret = apml->read_mailbox(apml_socket(soc_num), READ_PPIN_FUSE, LO_WORD_REG, &buffer);
+        cmd_result(soc_num, CAP_PPIN, ret);
+        if(ret == OOB_NOT_SUPPORTED)
+        {
+          // a definite answer, retrying will not change it
+          break;
+        }
+        if(ret != 0)
+        {
+          apml->pause(MUX_SLEEP_USEC);
+          retry++;
+        }
+        else
+        {
+          break;
+        }
+      }//end of retry
+
+      if (!ret)
+      {
+          data = buffer;
+          // Read higher 32 bit PPIN data
+          ret = apml->read_mailbox(apml_socket(soc_num), READ_PPIN_FUSE, HI_WORD_REG, &buffer);
+          if (!ret)
+          {
+            data |= ((uint64_t)buffer << 32);
+            CPU_INFO_DEBUG("ppin_fuse data 0x%llx \n", (unsigned long long)data);
+            //now decode PPIN to get SN
+            decode_PPIN(soc_num, data);
+          }
+          else
+          {
+            collect_error("Error reading higher 32 PPN value \n");
+          }
+      }
+      else
+      {
+          collect_error("Error reading lower 32 PPN value \n");
+      }
+   }
+   catch (std::exception& e)
+   {
+      collect_error("Error getting PPN value \n");
+      return ;
+   }
+}
+void CpuCollector::get_microcode_rev(uint8_t soc_num)
+{
+    uint32_t ucode;
+    oob_status_t ret;
+    try
+    {
+      if (!cmd_supported(soc_num, CAP_UCODE))
+      {
+          return;
+      }
+      ret = apml->read_mailbox(apml_socket(soc_num), READ_UCODE_REVISION, 0, &ucode);
+      cmd_result(soc_num, CAP_UCODE, ret);
+      if (ret) {
+          collect_error("Failed to read ucode revision\n");
+          return;
+      }
+      CPU_INFO_DEBUG("|ucode revision  | 0x%-32x |\n", ucode);
+      //set the Dbus value
+      char microid[PROP_STR_LEN];
+      snprintf(microid, sizeof(microid), "0x%x", ucode);
+      set_cpu_string_value(soc_num, microid, "Microcode", CPU_INTERFACE);
+    }
+    catch (std::exception& e)
+    {
+        collect_error("Error getting microcode: %s \n", e.what());
+    }
+}
+//false when the capability cache knows this CPU does not support cmd
+bool CpuCollector::cmd_supported(uint8_t soc_num, ApmlCommand cmd)
+{
+    if (!caps)
+    {
+        return true;
+    }
+    return caps->lookup(signatures[socket_index(soc_num)], cmd) != CAP_UNSUPPORTED;
+}
+//record a definite answer of the CPU to cmd
+void CpuCollector::cmd_result(uint8_t soc_num, ApmlCommand cmd, oob_status_t ret)
+{
+    if (!caps)
+    {
+        return;
+    }
+    // other errors can mean the mailbox is not up yet, they prove nothing
+    if (ret == OOB_SUCCESS)
+    {
+        caps->record(signatures[socket_index(soc_num)], cmd, CAP_SUPPORTED);
+    }
+    else if (ret == OOB_NOT_SUPPORTED)
+    {
+        caps->record(signatures[socket_index(soc_num)], cmd, CAP_UNSUPPORTED);
+    }
+}
+//Stage a CPU DBus property, the owner decides how it gets published
+void CpuCollector::set_cpu_property(uint8_t soc_num, const char *property_name, uint8_t enum_val, const PropertyValue& value)
+{
+    pending.push_back({soc_num, enum_val, property_name, value});
+}
+//Set the CPU DBus value
+void CpuCollector::set_cpu_string_value(uint8_t soc_num, std::string_view value, const char *property_name, uint8_t enum_val)
+{
+    PropertyString str;
+    size_t len = std::min(value.size(), sizeof(str.str) - 1);
+
+    memcpy(str.str, value.data(), len);
+    str.str[len] = '\0';
+    set_cpu_property(soc_num, property_name, enum_val, PropertyValue(str));
+}
+void CpuCollector::set_cpu_int_value(uint8_t soc_num, uint32_t value, const char *property_name, uint8_t enum_val)
+{
+    set_cpu_property(soc_num, property_name, enum_val, PropertyValue(value));
+}
+void CpuCollector::set_cpu_bool_value(uint8_t soc_num, bool value, const char *property_name, uint8_t enum_val)
+{
+    set_cpu_property(soc_num, property_name, enum_val, PropertyValue(value));
+}
+void CpuCollector::set_cpu_int16_value(uint8_t soc_num, uint16_t value, const char *property_name, uint8_t enum_val)
+{
+    set_cpu_property(soc_num, property_name, enum_val, PropertyValue(value));
+}
+//decode PPIN to get SN
+void CpuCollector::decode_PPIN(uint8_t soc_num, uint64_t data)
+{
+    char setppinstr[PROP_STR_LEN];
+    char serialnum[SERIAL_NUM_LEN] = {0};
+
+    snprintf(setppinstr, sizeof(setppinstr), "0x%llx", (unsigned long long)data);
+    CPU_INFO_DEBUG("PPIN Fuse : %s \n", setppinstr);
+    set_cpu_string_value(soc_num, setppinstr, "PPIN", CPU_INTERFACE);
+
+    //serial Number = lotstring + month + year + devnum
+    decode_ppin_serial(data, serialnum, sizeof(serialnum));
+    CPU_INFO_DEBUG("Serial Number # %s \n", serialnum);
+    set_cpu_string_value(soc_num, serialnum, "SerialNumber", ASSET_INTERFACE);
+
+    return;
+}
@@ -0,0 +1,104 @@
+#include "cpu_decode.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+// PPIN logic
+#define MASKNO_14BITS 0x00003FFF
+#define DEV_LENGTH 4
+#define MASKNO_MON_YEAR 0x001FC000
+#define DATECODE_SHIFT 14
+#define MONTH_VAL 10
+#define MONTHS_IN_YEAR 12
+#define LOTNUM_SHIFT 21
+#define MAX_ALPHA_NUM 37
+#define MAX_ALPHA_LENGTH 27
+#define ALPHA_CHAR_CONVER_VAL 64
+#define DIGIT_CONVER_VAL 21
+#define BYTE_MASK 0xFF
+#define BITS_PER_BYTE 8
+
+// Marking month code, indexed by month - 1
+static const constexpr char months_code[] = "MNOPQRSTUVWX";
+
+//function to decode Marking Month - last Digit of making Year and Unit # in lot
+void decode_datemonth_unitlot(uint64_t ppin, char* buf, size_t len)
+{
+    uint32_t lower32ppin = (uint32_t)ppin;
+
+    //Bits 0-13 are Dev Number
+    int devnum = (lower32ppin & MASKNO_14BITS);
+
+    //Bits 14-20 are Month/Year
+    int datecode = (lower32ppin & MASKNO_MON_YEAR) >> DATECODE_SHIFT;
+    int month = (datecode / MONTH_VAL) + 1;
+    int year = datecode % MONTH_VAL;
+
+    //add leading zeros to the dev number if less then 4 digit
+    if (month >= 1 && month <= MONTHS_IN_YEAR)
+    {
+        snprintf(buf, len, "%c%d%0*d", months_code[month - 1], year, DEV_LENGTH, devnum);
+    }
+    else
+    {
+        snprintf(buf, len, "%d%0*d", year, DEV_LENGTH, devnum);
+    }
+}
+//decode marked lot number char length is 7 -Fuse/mak lot #
+void decode_lotstring(uint64_t ppin, char* lotstr)
+{
+    //Bits 21-57 are Marked Lot Number
+    uint64_t converter_num = ppin >> LOTNUM_SHIFT;
+    uint64_t decodechar_num;
+
+    //Now convert Marked Lot through Alpha Numeric 37 decoding
+    //marked lot is 7 char string, decoded last char first
+    for (int i = LOTNUM_LENGTH - 1; i >= 0; i--)
+    {
+       decodechar_num = converter_num % MAX_ALPHA_NUM;
+       converter_num = converter_num / MAX_ALPHA_NUM;
+       if (decodechar_num < MAX_ALPHA_LENGTH)
+       {
+           lotstr[i] = decodechar_num + ALPHA_CHAR_CONVER_VAL;
+       }
+       else
+       {
+           lotstr[i] = decodechar_num + DIGIT_CONVER_VAL;
+       }
+    }
+    lotstr[LOTNUM_LENGTH] = '\0';
+}
+//decode PPIN to get SN
+void decode_ppin_serial(uint64_t ppin, char* buf, size_t len)
+{
+    char lotstr[LOTNUM_LENGTH + 1];
+
+    if (len <= LOTNUM_LENGTH)
+    {
+        if (len)
+            buf[0] = '\0';
+        return;
+    }
+    decode_lotstring(ppin, lotstr);
+    memcpy(buf, lotstr, LOTNUM_LENGTH);
+    decode_datemonth_unitlot(ppin, buf + LOTNUM_LENGTH, len - LOTNUM_LENGTH);
+}
+//OPN is the little endian byte stream of the CPUID brand string registers
+void decode_opn(const uint32_t regs[OPN_LEAF_COUNT][OPN_REG_COUNT], char* opn)
+{
+    int pos = 0;
+
+    for (int leaf = 0; leaf < OPN_LEAF_COUNT; leaf++)
+    {
+        for (int reg = 0; reg < OPN_REG_COUNT; reg++)
+        {
+            for (int byte = 0; byte < 4; byte++)
+            {
+                opn[pos++] = (regs[leaf][reg] >> (byte * BITS_PER_BYTE)) & BYTE_MASK;
+            }
+        }
+    }
+    // the brand string is NUL padded, last byte is always the terminator
+    opn[OPN_BUFF_LEN - 2] = '\0';
+    opn[OPN_BUFF_LEN - 1] = '\0';
+}
@@ -1,853 +1,386 @@
 #include "cpu_info.hpp"
+#include "cpu_log.hpp"
 
-#include "iomanip"
-#include <boost/asio.hpp>
-#include <boost/asio/spawn.hpp>
-#include <boost/asio/error.hpp>
-#include <sdbusplus/asio/connection.hpp>
-#include <sdbusplus/asio/property.hpp>
-#include <gpiod.hpp>
-#include <filesystem>
-#include <linux/types.h>
-#include <linux/ioctl.h>
+#include <algorithm>
 
-extern "C" {
-#include <unistd.h>
-#include "linux/i2c-dev.h"
-#include "i2c/smbus.h"
-#include "apml64Config.h"
-#include "esmi_cpuid_msr.h"
-#include "apml.h"
-#include "esmi_mailbox.h"
-#include "esmi_rmi.h"
-#include "esmi_cpuid_msr.h"
-#include "esmi_tsi.h"
-#include "esmi_mailbox_nda.h"
-}
-
-#define COMMAND_NUM_OF_CPU    ("/sbin/fw_printenv -n num_of_cpu")
-#define COMMAND_LEN         (3)
-#define MAX_RETRY           20
-
-#define CMD_BUFF_LEN     256
-#define FNAME_LEN        128
-
-// AMPL command
-#define EAX_VAL 1
-#define EAX_DATA_LEN_1 4
-#define EAX_DATA_LEN_2 8
-#define EAX_DATA_LEN_3 16
-#define EAX_DATA_LEN_4 20
-#define EAX_MASK_MAGIC_1 0xf
-#define EAX_MASK_MAGIC_2 0xff
-#define EAX_MASK_MAGIC_3 0x10
-#define APML_SLEEP 10000
-#define MUX_SLEEP 5
-
-// PPIN logic
-#define LOWER_PINBITS 8
-#define MASKNO_14BITS 0x00003FFF
-#define DEV_LENGTH 4
-#define MASKNO_MON_YEAR 0x001FC000
-#define DATECODE_SHIFT 14
-#define MONTH_VAL 10
-#define LOTNUM_SHIFT 21
-#define LOTNUM_LENGTH 7
-#define MAX_ALPHA_NUM 37
-#define MAX_ALPHA_LENGTH 27
-#define ALPHA_CHAR_CONVER_VAL 64
-#define DIGIT_CONVER_VAL 21
-#define HEX "0x"
-#define LENGTH_DIV 2
-
-const std::string P0_Present = "P0_PRESENT_L";
-const std::string P1_Present = "P1_PRESENT_L";
-const std::string DBUS_Present = "Present";
-
-constexpr auto P0_PATH = "/xyz/openbmc_project/inventory/system/processor/P0";
-constexpr auto P1_PATH = "/xyz/openbmc_project/inventory/system/processor/P1";
-
-CpuInfoDataHolder* CpuInfoDataHolder::instance = 0;
-
-uint8_t p0_info = 0;
-uint8_t p1_info = 1;
-uint32_t eax;
-uint32_t ebx;
-uint32_t ecx;
-uint32_t edx;
-
-// Init CPU Information using OOB library
-void CpuInfo::collect_cpu_information()
+// a time-to-inventory sample starts at the first host signal
+void CpuInfo::begin_measure()
 {
-
-  for(uint8_t soc_num = 0; soc_num < num_of_proc;  soc_num++)
-  {
-     if (connect_apml_get_family_model_step(soc_num))
-     {
-        set_general_info(soc_num);
-        get_cpu_base_freq(soc_num);
-        get_ppin_fuse(soc_num);
-        get_threads_per_core_and_soc(soc_num);
-        get_microcode_rev(soc_num);
-        get_opn(soc_num);
-     }
-  }
-
+    if (!measuring)
+    {
+        measuring = true;
+        inventory_start = std::chrono::steady_clock::now();
+    }
 }
 
-int CpuInfo::getGPIOValue(const std::string& name)
+// Kick off a collection on the worker pool, at most one per host in flight
+void CpuInfo::start_collection()
 {
-    int value;
-    gpiod::line gpioLine;
-
-    // Find the GPIO line
-    gpioLine = gpiod::find_line(name);
-    if (!gpioLine)
-    {
-        sd_journal_print(LOG_ERR, "Can't find line: %s \n", name.c_str());
-        return -1;
-    }
-    try
+    begin_measure();
+    if (collecting || fetching)
     {
-        gpioLine.request({__FUNCTION__, gpiod::line_request::DIRECTION_INPUT});
+        // host state changed again mid collection or lazy read, run once
+        // more after it
+        recollect = true;
+        if (stats)
+        {
+            stats->coalesced();
+        }
+        return;
     }
-    catch (std::system_error& exc)
+    if (stats)
     {
-        sd_journal_print(LOG_ERR, "Error setting gpio as Input: %s \n", name.c_str());
-        return -1;
+        stats->collection_started();
     }
-
-    try
+    collecting = true;
+    recollect = false;
+    if (telemetry)
     {
-        value = gpioLine.get_value();
+        // inventory first, sampling waits for the bus
+        telemetry->bus_busy(true);
     }
-    catch (std::system_error& exc)
+    if (notifier)
     {
-        sd_journal_print(LOG_ERR, "Error getting gpio value for: %s \n", name.c_str());
-        return -1;
+        notifier->collection_started(host_num);
     }
 
-    return value;
+    pool.post([this]() {
+        pending.clear();
+        timings.clear();
+        present.clear();
+        collected = 0;
+        collect_cpu_information();
+        // pending and present are left to the loop, the next job of this
+        // host is only posted from there, so their capacity is reused
+        pool.post_to_loop([this]() {
+            const std::vector<uint8_t>& sockets = present;
+            for (uint8_t soc_num = get_first_socket();
+                 soc_num < get_first_socket() + collected; soc_num++)
+            {
+                bool answered = std::find(sockets.begin(), sockets.end(), soc_num) !=
+                                sockets.end();
+                record_snapshot(soc_num, true, answered, answered ? collection_fields() : 0);
+            }
+            publish(pending);
+            if (telemetry)
+            {
+                for (uint8_t soc_num : sockets)
+                {
+                    telemetry->set_active(soc_num, true, apml_socket(soc_num));
+                }
+                telemetry->bus_busy(false);
+            }
+            start_core_enumeration(sockets);
+            lazy_collected(sockets);
+            if (notifier)
+            {
+                notifier->collection_done(host_num);
+            }
+            collecting = false;
+            sets_done();
+            if (recollect)
+            {
+                start_collection();
+            }
+            else
+            {
+                run_lazy();
+            }
+        });
+    }, host_num);
 }
-//Call Apml library to get the CPU Info
-bool CpuInfo::connect_apml_get_family_model_step(uint8_t soc_num )
+
+void CpuInfo::init_host_state()
 {
-    int retry = 0;
-    oob_status_t ret;
-    uint32_t family_id;
-    uint32_t model_id;
-    uint32_t step_id;
-    uint32_t ext_family;
-    uint32_t ext_model;
-    int core_id = 0;
-    uint16_t freq;
-    uint16_t cpuPresence;
-    ebx = 0;
-    edx = 0;
-    eax = EAX_VAL;
-    ecx = 0;
-    try
+    for (uint8_t soc_num = get_first_socket(); soc_num < get_first_socket() + MAX_SOCKETS_PER_HOST; soc_num++)
     {
-      while(retry < MAX_RETRY)
-      {
-        ret = esmi_oob_cpuid(soc_num, core_id, &eax, &ebx, &ecx, &edx);
-        if(ret != 0)
-        {
-          sleep(MUX_SLEEP);
-          retry++;
-        }
-        else
+        if (notifier && snapshot.has_record(soc_num))
         {
-          break;
+            notifier->host_ready(host_num, "warm snapshot");
         }
-      }//end of retry
-
-      std::string processor_presence = (soc_num == 0) ? P0_Present: P1_Present;
-      cpuPresence = getGPIOValue(processor_presence);
-      if (cpuPresence == 1)
-      {
-         //set false -Absent if GPIO value is high -default is true
-         set_cpu_bool_value(soc_num, false, DBUS_Present, CPU_INTERFACE);
-         sd_journal_print(LOG_INFO, "Warning : %d CPU is absent \n", soc_num);
-         return false;
-      }
-
-      if(ret != 0)
-      {
-        sd_journal_print(LOG_ERR, "Error : Unable to get the CPU info from APML \n" );
-      }
-      else
-      {
-        char cpuid[CMD_BUFF_LEN] = {0};
-
-        ext_family = ((eax >> EAX_DATA_LEN_4) & EAX_MASK_MAGIC_2);
-        sprintf(cpuid, "%x (%d)", ext_family, ext_family);
-        //convert char to string
-        std::string eff_family_str(cpuid);
-        set_cpu_string_value(soc_num, eff_family_str, "EffectiveFamily", CPU_INTERFACE);
-
-        cpuid[CMD_BUFF_LEN] = {0};
-        family_id = ((eax >> EAX_DATA_LEN_2) & EAX_MASK_MAGIC_1) + ext_family;
-        sprintf(cpuid, "%x (%d)", family_id, family_id);
-        std::string family_str(cpuid);
-        set_cpu_string_value(soc_num, family_str, "Family", CPU_INTERFACE);
-
-        cpuid[CMD_BUFF_LEN] = {0};
-        ext_model = ((eax >> EAX_DATA_LEN_3) & EAX_MASK_MAGIC_1);
-        sprintf(cpuid, "%x (%d)", ext_model, ext_model);
-        std::string eff_model_str(cpuid);
-        set_cpu_string_value(soc_num, eff_model_str, "EffectiveModel", CPU_INTERFACE);
-
-        cpuid[CMD_BUFF_LEN] = {0};
-        model_id = ext_model * EAX_MASK_MAGIC_3 + ((eax >> EAX_DATA_LEN_1) & EAX_MASK_MAGIC_1);
-        sprintf(cpuid, "%x (%d)", model_id, model_id);
-        std::string model_str(cpuid);
-        set_cpu_string_value(soc_num, model_str, "Model", CPU_INTERFACE);
-
-        cpuid[CMD_BUFF_LEN] = {0};
-        step_id = eax & EAX_MASK_MAGIC_1 ;
-        sprintf(cpuid, "%x (%d)", step_id, step_id);
-        std::string step_str(cpuid);
-        set_cpu_string_value(soc_num, step_str, "Step", CPU_INTERFACE);
-
-        cpuid[CMD_BUFF_LEN] = {0};
-        sprintf(cpuid, "%d", soc_num);
-        std::string socket_str(cpuid);
-        set_cpu_string_value(soc_num, socket_str, "Socket", CPU_INTERFACE);
-
-        return true;
-      }
     }
-    catch (std::exception& e)
+
+    if (!read_host_state())
     {
-       sd_journal_print(LOG_ERR, "Error getting CPU Model, Family and Step value \n");
-       return false;
+        retry_host_state();
     }
-
-    return false;
 }
-// Get the OPN
-void CpuInfo::get_opn(uint8_t soc_num)
-{
-    int32_t cpuid_fn = 1;
-    uint32_t cpuid_extd_fn = 0;
-    uint32_t thread_ind = 0;
-    uint32_t eax_value, ebx_value, ecx_value, edx_value;
-    u_int8_t write_opn_data[OPN_LENGTH] = {0};
-    char OpnChar [OPN_LENGTH] = {0};
 
-    cpuid_fn = CPUID_Fn8000002;
-    if(read_register(soc_num, thread_ind, cpuid_fn, cpuid_extd_fn, &eax_value, &ebx_value, &ecx_value, &edx_value))
-    {
-        //eax
-        write_opn_data[0] = (eax_value & MASK_TWO_BYTES);
-        write_opn_data[1] = get_reg_offset_conv(eax_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[2] = get_reg_offset_conv(eax_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[3] = get_reg_offset_conv(eax_value, SHIFT_24, MASK_BYTE_4);
-        //ebx
-        write_opn_data[4] = (ebx_value & MASK_TWO_BYTES);
-        write_opn_data[5] = get_reg_offset_conv(ebx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[6] = get_reg_offset_conv(ebx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[7] = get_reg_offset_conv(ebx_value, SHIFT_24, MASK_BYTE_4);
-        //ecx
-        write_opn_data[8] = (ecx_value & MASK_TWO_BYTES);
-        write_opn_data[9] = get_reg_offset_conv(ecx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[10] = get_reg_offset_conv(ecx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[11] = get_reg_offset_conv(ecx_value, SHIFT_24, MASK_BYTE_4);
-        //edx
-        write_opn_data[12] = (edx_value & MASK_TWO_BYTES);
-        write_opn_data[13] = get_reg_offset_conv(edx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[14] = get_reg_offset_conv(edx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[15] = get_reg_offset_conv(edx_value, SHIFT_24, MASK_BYTE_4);
-    }
-    else
-    {
-        sd_journal_print(LOG_ERR, "Failed to read 0x80000002 register value \n");
-        return;
-    }
+// false when CurrentHostState could not be read, nothing is known then
+bool CpuInfo::read_host_state()
+{
+    std::string path = CpuInfoDataHolder::HostStatePathPrefix + std::to_string(host_num);
+    std::string service = "xyz.openbmc_project.State.Host" + std::to_string(host_num);
+    bool running = false;
+    bool started = false;
 
-    cpuid_fn = CPUID_Fn8000003;
-    if(read_register(soc_num, thread_ind, cpuid_fn, cpuid_extd_fn, &eax_value, &ebx_value, &ecx_value, &edx_value))
+    try
     {
-        //eax
-        write_opn_data[16] = (eax_value & MASK_TWO_BYTES);
-        write_opn_data[17] = get_reg_offset_conv(eax_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[18] = get_reg_offset_conv(eax_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[19] = get_reg_offset_conv(eax_value, SHIFT_24, MASK_BYTE_4);
-        //ebx
-        write_opn_data[20] = (ebx_value & MASK_TWO_BYTES);
-        write_opn_data[21] = get_reg_offset_conv(ebx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[22] = get_reg_offset_conv(ebx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[23] = get_reg_offset_conv(ebx_value, SHIFT_24, MASK_BYTE_4);
-        //ecx
-        write_opn_data[24] = (ecx_value & MASK_TWO_BYTES);
-        write_opn_data[25] = get_reg_offset_conv(ecx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[26] = get_reg_offset_conv(ecx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[27] = get_reg_offset_conv(ecx_value, SHIFT_24, MASK_BYTE_4);
-        //edx
-        write_opn_data[28] = (edx_value & MASK_TWO_BYTES);
-        write_opn_data[29] = get_reg_offset_conv(edx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[30] = get_reg_offset_conv(edx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[31] = get_reg_offset_conv(edx_value, SHIFT_24, MASK_BYTE_4);
+        auto method = bus.new_method_call(service.c_str(), path.c_str(),
+                                          CpuInfoDataHolder::PropertiesIntf, "Get");
+        method.append("xyz.openbmc_project.State.Host", "CurrentHostState");
+        auto reply = bus.call(method);
+        std::variant<std::string> state;
+        reply.read(state);
+        running = StateServer::Host::convertHostStateFromString(std::get<std::string>(state)) !=
+                  StateServer::Host::HostState::Off;
     }
-    else
+    catch (std::exception& e)
     {
-        sd_journal_print(LOG_ERR, "Failed to read 0x80000003 register value \n");
-        return;
+        sd_journal_print(LOG_INFO, "host%d state not available yet : %s \n", host_num, e.what());
+        return false;
     }
+    host_state_known = true;
+    host_running = running;
 
-    cpuid_fn = CPUID_Fn8000004;
-    if(read_register(soc_num, thread_ind, cpuid_fn, cpuid_extd_fn, &eax_value, &ebx_value, &ecx_value, &edx_value))
+    // BootProgress keeps the last stage of the previous boot once the host is off
+    boot_signals = read_boot_progress(started);
+    if (running && started)
     {
-        write_opn_data[32] = (eax_value & MASK_TWO_BYTES);
-        write_opn_data[33] = get_reg_offset_conv(eax_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[34] = get_reg_offset_conv(eax_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[35] = get_reg_offset_conv(eax_value, SHIFT_24, MASK_BYTE_4);
-        //ebx
-        write_opn_data[36] = (ebx_value & MASK_TWO_BYTES);
-        write_opn_data[37] = get_reg_offset_conv(ebx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[38] = get_reg_offset_conv(ebx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[39] = get_reg_offset_conv(ebx_value, SHIFT_24, MASK_BYTE_4);
-        //ecx
-        write_opn_data[40] = (ecx_value & MASK_TWO_BYTES);
-        write_opn_data[41] = get_reg_offset_conv(ecx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[42] = get_reg_offset_conv(ecx_value, SHIFT_16, MASK_BYTE_3);
-        write_opn_data[43] = get_reg_offset_conv(ecx_value, SHIFT_24, MASK_BYTE_4);
-        //edx
-        write_opn_data[44] = (edx_value & MASK_TWO_BYTES);
-        write_opn_data[45] = get_reg_offset_conv(edx_value, SHIFT_8,  MASK_BYTE_2);
-        write_opn_data[46] = get_reg_offset_conv(edx_value, SHIFT_16, MASK_BYTE_3);
+        boot_progress(true);
     }
-    else
+    else if (running)
     {
-        sd_journal_print(LOG_ERR, "Failed to read 0x80000004 register value \n");
-        return;
+        boot_host_on();
     }
-
-    //convert hex to ascii
-    for (int i = 0; i < OPN_LENGTH; i++)
+    else if (notifier)
     {
-       OpnChar[i] = (char) write_opn_data[i];
+        notifier->host_ready(host_num, "host off");
     }
-
-    //convert char to opn string
-    std::string opn_str(OpnChar);
-    sd_journal_print(LOG_INFO, "OPN string # %s \n", opn_str.c_str());
-
-    //set the value in DBUS
-    set_cpu_string_value(soc_num, opn_str, PARTNUMBER, ASSET_INTERFACE);
-
+    return true;
 }
-// Read register thru apml lib
-bool CpuInfo::read_register(uint8_t soc_num, uint32_t thread_ind, uint32_t cpuid_fn, uint32_t cpuid_extd_fn, uint32_t *eax_value, uint32_t *ebx_value, uint32_t *ecx_value, uint32_t *edx_value)
+
+// the PropertiesChanged match may answer first, the retries stop then
+void CpuInfo::retry_host_state()
 {
-    bool ret = false;
-    if(OOB_SUCCESS == esmi_oob_cpuid_eax(soc_num, thread_ind, cpuid_fn, cpuid_extd_fn, eax_value))
+    uint64_t now;
+    int ret;
+
+    if (event == nullptr)
     {
-       if(OOB_SUCCESS == esmi_oob_cpuid_ebx(soc_num, thread_ind, cpuid_fn, cpuid_extd_fn, ebx_value))
-       {
-          if(OOB_SUCCESS == esmi_oob_cpuid_ecx(soc_num, thread_ind, cpuid_fn, cpuid_extd_fn, ecx_value))
-          {
-             if(OOB_SUCCESS == esmi_oob_cpuid_edx(soc_num, thread_ind, cpuid_fn, cpuid_extd_fn, edx_value))
-             {
-                ret = true;
-             }
-             else
-             {
-                sd_journal_print(LOG_ERR, "Error reading register eax \n");
-             }
-          }
-          else
-          {
-             sd_journal_print(LOG_ERR, "Error reading register ecx \n");
-          }
-       }
-       else
-       {
-          sd_journal_print(LOG_ERR, "Error reading register ebx \n");
-       }
+        return;
     }
-    else
+    sd_event_now(event, CLOCK_MONOTONIC, &now);
+    if (host_state_timer == nullptr)
     {
-       sd_journal_print(LOG_ERR, "Error reading register eax \n");
+        ret = sd_event_add_time(event, &host_state_timer, CLOCK_MONOTONIC,
+                                now + HOST_STATE_RETRY_SEC * 1000000ULL, 0,
+                                on_host_state_timer, this);
     }
-
-    return ret;
-}
-//get byte value
-u_int8_t  CpuInfo::get_reg_offset_conv(uint32_t reg, uint32_t offset, uint32_t flag)
-{
-	return ((reg & flag ) >> offset);
-}
-void CpuInfo::set_general_info(uint8_t soc_num)
-{
-    set_cpu_string_value(soc_num, "AMD", "Manufacturer", ASSET_INTERFACE);
-    set_cpu_string_value(soc_num, "AuthenticAMD", "VendorId", CPU_INTERFACE);
-
-}
-//Get processor threads per Core and Socket
-void CpuInfo::get_threads_per_core_and_soc(uint8_t soc_num)
-{
-    uint32_t threads_per_core, threads_per_soc;
-    bool isthreadcall_pass;
-    oob_status_t ret;
-    try
+    else
     {
-      ret = esmi_get_threads_per_socket(soc_num, &threads_per_soc);
-      if (ret)
-      {
-        sd_journal_print(LOG_ERR, "esmi_get_threads_per_socket call failed \n");
-      }
-      else
-      {
-        set_cpu_int16_value(soc_num, threads_per_soc, "ThreadCount", CPU_INTERFACE);
-        isthreadcall_pass = true;
-      }
-      usleep(APML_SLEEP);
-
-      ret = esmi_get_threads_per_core(soc_num, &threads_per_core);
-      if (ret)
-      {
-        sd_journal_print(LOG_ERR, "esmi_get_threads_per_core call failed \n");
-      }
-      else
-      {
-        if(isthreadcall_pass)
+        ret = sd_event_source_set_time(host_state_timer, now + HOST_STATE_RETRY_SEC * 1000000ULL);
+        if (ret >= 0)
         {
-          uint32_t TotalCores = threads_per_soc / threads_per_core;
-          set_cpu_int16_value(soc_num, TotalCores, "CoreCount", CPU_INTERFACE);
+            ret = sd_event_source_set_enabled(host_state_timer, SD_EVENT_ONESHOT);
         }
-      }
     }
-    catch (std::exception& e)
+    if (ret < 0)
     {
-       sd_journal_print(LOG_ERR, "Error getting Thread and Socket \n");
-       return ;
+        log_ratelimited(LOG_ERR, "Failed to arm the host state timer : %d \n", ret);
     }
 }
 
-void CpuInfo::get_cpu_base_freq(uint8_t soc_num)
-{
-    uint32_t  buffer, value;
-    oob_status_t ret;
-    try
-    {
-       ret = esmi_oob_read_mailbox(soc_num, READ_BMC_CPU_BASE_FREQUENCY, 0, &buffer);
-       if (ret != OOB_SUCCESS) {
-            sd_journal_print(LOG_ERR, "read bmc cpu base freq failed \n");
-            return;
-       }
-     }
-     catch (std::exception& e)
-     {
-        sd_journal_print(LOG_ERR, "Error getting CPU Base Freq value \n");
-        return ;
-     }
-     set_cpu_int_value(soc_num, buffer, "MaxSpeedInMhz", CPU_INTERFACE);
-}
-//Get PPIN then we need to Decode to get Serial Number
-void CpuInfo::get_ppin_fuse(uint8_t soc_num)
+int CpuInfo::on_host_state_timer(sd_event_source *source, uint64_t usec, void *userdata)
 {
-    uint32_t buffer = 0;
-    oob_status_t ret;
-    uint64_t data = 0;
-    char cpuid[CMD_BUFF_LEN];
-    int retry = 0;
-    //APML read mail box takes time to init, hence added retry
-    try
-    {
-      while(retry < MAX_RETRY)
-      {
-        // Read lower 32 bit PPIN data$
-        ret = esmi_oob_read_mailbox(soc_num, READ_PPIN_FUSE, LO_WORD_REG, &buffer);
-        if(ret != 0)
-        {
-          sleep(MUX_SLEEP);
-          retry++;
-        }
-        else
-        {
-          break;
-        }
-      }//end of retry
+    CpuInfo *self = static_cast<CpuInfo *>(userdata);
 
-      if (!ret)
-      {
-          data = buffer;
-          // Read higher 32 bit PPIN data
-          ret = esmi_oob_read_mailbox(soc_num, READ_PPIN_FUSE, HI_WORD_REG, &buffer);
-          if (!ret)
-          {
-            data |= ((uint64_t)buffer << 32);
-            sd_journal_print(LOG_INFO, "ppin_fuse data %d", data);
-            //now decode PPIN to get SN
-            decode_PPIN(soc_num, data);
-          }
-      }
-      else
-      {
-          sd_journal_print(LOG_ERR, "Error reading lower 32 PPN value \n");
-      }
-   }
-   catch (std::exception& e)
-   {
-      sd_journal_print(LOG_ERR, "Error getting PPN value \n");
-      return ;
-   }
-}
-void CpuInfo::get_microcode_rev(uint8_t soc_num)
-{
-    uint32_t ucode;
-    oob_status_t ret;
-    try
+    if (!self->host_state_known && !self->read_host_state())
     {
-      ret = esmi_oob_read_mailbox(soc_num, READ_UCODE_REVISION, 0, &ucode);
-      if (ret) {
-          sd_journal_print(LOG_ERR,"Failed to read ucode revision\n");
-          return;
-      }
-      sd_journal_print(LOG_INFO,"|ucode revision  | 0x%-32x |\n", ucode);
-      //set the Dbus value
-      char microid[CMD_BUFF_LEN] = {0};
-      sprintf(microid, "0x%x",ucode);
-      //convert char to string
-      std::string microcode_str(microid);
-      set_cpu_string_value(soc_num, microcode_str, "Microcode", CPU_INTERFACE);
-    }
-    catch (std::exception& e)
-    {
-        sd_journal_print(LOG_ERR, "Error getting microcode: %s \n", e.what());
+        self->retry_host_state();
     }
+    return 0;
 }
-//get the platform ID
-bool CpuInfo::getNumberOfCpu()
+
+void CpuInfo::on_step(uint8_t soc_num, const char *step)
 {
-    FILE *pf;
-    char data[COMMAND_LEN];
-    try
+    if (notifier)
     {
-       // Setup pipe for reading and execute to get u-boot environment
-       pf = popen(COMMAND_NUM_OF_CPU,"r");
-       if(pf > 0)
-       {   // no error
-          if (fgets(data, COMMAND_LEN , pf) != NULL)
-          {
-             num_of_proc = stoi((std::string)data);
-             sd_journal_print(LOG_INFO, "Number of Cpu %d\n", num_of_proc);
-          }
-          pclose(pf);
-          return true;
-       }
-       else
-       {
-          sd_journal_print(LOG_ERR, "Failed to open command stream \n");
-       }
+        notifier->status("host%d P%d: %s", host_num, soc_num, step);
     }
-    catch (std::exception& e)
-    {
-      sd_journal_print(LOG_ERR, "Error reading number of cpu %s \n", e.what());
-    }
-
-    return false;
 }
 
-std::string CpuInfo::get_interface(uint8_t enum_val )
+const char* CpuInfo::get_interface(uint8_t enum_val )
 {
     return enum_str[enum_val];
 }
-//Set the CPU DBus value
-void CpuInfo::set_cpu_string_value(uint8_t soc_num, std::string value, std::string property_name, uint8_t enum_val)
+//Reply handler for the asynchronous property Set calls
+int CpuInfo::set_property_reply(sd_bus_message* reply, void* userdata, sd_bus_error* error)
 {
-   try
-   {
-       sd_journal_print(LOG_INFO, "Set the DBUS Property of %s \n", property_name.c_str());
-       sdbusplus::bus::bus bus = sdbusplus::bus::new_default();
-       boost::system::error_code ec;
-       boost::asio::io_context io;
-       auto conn = std::make_shared<sdbusplus::asio::connection>(io);
-       if (soc_num == 0)
-       {
-         conn->async_method_call(
-             [this](boost::system::error_code ec) {
-                 if (ec)
-                 {
-                     sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n");
-                 }
-             },
-             "xyz.openbmc_project.Inventory.Manager",
-             P0_PATH,
-             "org.freedesktop.DBus.Properties", "Set",
-             get_interface(enum_val), property_name,
-             std::variant<std::string>(value));
-       }
-       else if (soc_num == 1)
-       {
-          conn->async_method_call(
-             [this](boost::system::error_code ec) {
-                 if (ec)
-                 {
-                     sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n" );
-                 }
-             },
-             "xyz.openbmc_project.Inventory.Manager",
-             P1_PATH,
-             "org.freedesktop.DBus.Properties", "Set",
-             get_interface(enum_val), property_name,
-             std::variant<std::string>(value));
-       }
-   }
-   catch (std::exception& e)
-   {
-      sd_journal_print(LOG_ERR, "Error in setting Dbus : %s \n", e.what());
-   }
+    CpuInfo *self = static_cast<CpuInfo *>(userdata);
+
+    if (sd_bus_message_is_method_error(reply, nullptr))
+    {
+        // message and name of the error are both optional
+        const sd_bus_error *err = sd_bus_message_get_error(reply);
+        const char *reason = err && err->message ? err->message :
+                             err && err->name ? err->name : "unknown";
+        log_ratelimited(LOG_ERR, "Failed to set CPU value in dbus interface : %s (%d) \n",
+                        reason, sd_bus_message_get_errno(reply));
+        if (self->stats)
+        {
+            self->stats->set_failed();
+        }
+    }
+    self->outstanding_sets--;
+    self->sets_done();
+    return 0;
 }
-void CpuInfo::set_cpu_int_value(uint8_t soc_num, uint32_t value, std::string property_name, uint8_t enum_val)
+//Host is ready once a collection is published and every Set was answered
+void CpuInfo::sets_done()
 {
-    sd_journal_print(LOG_INFO,"Set the DBUS Property of %s \n", property_name.c_str());
-    sdbusplus::bus::bus bus = sdbusplus::bus::new_default();
-    boost::system::error_code ec;
-    boost::asio::io_context io;
-    auto conn = std::make_shared<sdbusplus::asio::connection>(io);
-    if (soc_num == 0)
+    if (collecting || outstanding_sets != 0)
     {
-      conn->async_method_call(
-          [this](boost::system::error_code ec) {
-              if (ec)
-              {
-                  sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n");
-              }
-          },
-          "xyz.openbmc_project.Inventory.Manager",
-          P0_PATH,
-          "org.freedesktop.DBus.Properties", "Set",
-          get_interface(enum_val), property_name,
-          std::variant<uint32_t>(value));
+        return;
     }
-    else if (soc_num == 1)
+    if (notifier)
     {
-       conn->async_method_call(
-          [this](boost::system::error_code ec) {
-              if (ec)
-              {
-                  sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n");
-              }
-          },
-          "xyz.openbmc_project.Inventory.Manager",
-          P1_PATH,
-          "org.freedesktop.DBus.Properties", "Set",
-          get_interface(enum_val), property_name,
-          std::variant<uint32_t>(value));
+        notifier->host_ready(host_num, "inventory published");
     }
-}
-
-void CpuInfo::set_cpu_bool_value(uint8_t soc_num, bool value, std::string property_name, uint8_t enum_val)
-{
-    sd_journal_print(LOG_INFO,"Set the DBUS Property of %s \n", property_name.c_str());
-    sdbusplus::bus::bus bus = sdbusplus::bus::new_default();
-    boost::system::error_code ec;
-    boost::asio::io_context io;
-    auto conn = std::make_shared<sdbusplus::asio::connection>(io);
-    if (soc_num == 0)
+    if (measuring && !recollect)
     {
-      conn->async_method_call(
-          [this](boost::system::error_code ec) {
-              if (ec)
-              {
-                  sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n");
-              }
-          },
-          "xyz.openbmc_project.Inventory.Manager",
-          P0_PATH,
-          "org.freedesktop.DBus.Properties", "Set",
-          get_interface(enum_val), property_name,
-          std::variant<bool>(value));
+        measuring = false;
+        if (stats)
+        {
+            stats->inventory_done(std::chrono::steady_clock::now() - inventory_start);
+        }
     }
-    else if (soc_num == 1)
+}
+//Append the interface, name and variant value arguments of a Set call
+int CpuInfo::append_property(sd_bus_message *method, const PendingProperty& prop)
+{
+    int ret = sd_bus_message_append(method, "ss", get_interface(prop.enum_val), prop.name);
+    if (ret < 0)
     {
-       conn->async_method_call(
-          [this](boost::system::error_code ec) {
-              if (ec)
-              {
-                  sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n");
-              }
-          },
-          "xyz.openbmc_project.Inventory.Manager",
-          P1_PATH,
-          "org.freedesktop.DBus.Properties", "Set",
-          get_interface(enum_val), property_name,
-          std::variant<bool>(value));
+        return ret;
     }
+    if (auto str = std::get_if<PropertyString>(&prop.value))
+        return sd_bus_message_append(method, "v", "s", str->str);
+    if (auto u32 = std::get_if<uint32_t>(&prop.value))
+        return sd_bus_message_append(method, "v", "u", *u32);
+    if (auto u16 = std::get_if<uint16_t>(&prop.value))
+        return sd_bus_message_append(method, "v", "q", *u16);
+    return sd_bus_message_append(method, "v", "b", (int)std::get<bool>(prop.value));
 }
-void CpuInfo::set_cpu_int16_value(uint8_t soc_num, uint16_t value, std::string property_name, uint8_t enum_val)
+//Store what was read of one socket in the snapshot and report identity
+//changes of the fields it tried to read, full collections replace the
+//record, lazy reads add to it
+void CpuInfo::record_snapshot(uint8_t soc_num, bool full, bool answered, uint32_t read)
 {
-    sd_journal_print(LOG_INFO,"Set the DBUS Property of %s \n", property_name.c_str());
-    sdbusplus::bus::bus bus = sdbusplus::bus::new_default();
-    boost::system::error_code ec;
-    boost::asio::io_context io;
-    auto conn = std::make_shared<sdbusplus::asio::connection>(io);
-    if (soc_num == 0)
+    CpuShmRecord before = snapshot.record(soc_num);
+    if (full)
     {
-      conn->async_method_call(
-          [this](boost::system::error_code ec) {
-              if (ec)
-              {
-                  sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n");
-              }
-          },
-          "xyz.openbmc_project.Inventory.Manager",
-          P0_PATH,
-          "org.freedesktop.DBus.Properties", "Set",
-          get_interface(enum_val), property_name,
-          std::variant<uint16_t>(value));
+        snapshot.replace(soc_num, answered, pending);
     }
-    else if (soc_num == 1)
+    else
+    {
+        snapshot.update(soc_num, pending);
+    }
+    if (events)
     {
-       conn->async_method_call(
-          [this](boost::system::error_code ec) {
-              if (ec)
-              {
-                  sd_journal_print(LOG_ERR, "Failed to set CPU value in dbus interface \n");
-              }
-          },
-          "xyz.openbmc_project.Inventory.Manager",
-          P1_PATH,
-          "org.freedesktop.DBus.Properties", "Set",
-          get_interface(enum_val), property_name,
-          std::variant<uint16_t>(value));
+        events->compare(soc_num, before, snapshot.record(soc_num), read);
     }
 }
-//function to decode Marking Month - last Digit of making Year and Unit # in lot
-void CpuInfo::decode_datemonth_unitlot(char* ppinstr, std::string& datemonthlotstr)
+//Queue the Sets of the collected properties on the shared connection
+void CpuInfo::publish(const std::vector<PendingProperty>& props)
 {
-    std::string ppin_str(ppinstr);
-    size_t len = strlen(ppinstr);
-    // get lower PPIN
-    int offset = len - LOWER_PINBITS;
-    std::string lower32ppinstr = ppin_str.substr(offset, LOWER_PINBITS);
-    lower32ppinstr = HEX + lower32ppinstr;
-
-    //get upper PPIN
-    std::string upper32ppinstr = ppin_str.substr (0, (len - LOWER_PINBITS));
-    upper32ppinstr = HEX + upper32ppinstr;
-
-    //convert hex string to actual number
-    unsigned int upper32ppin;
-    std::stringstream ss1;
-    ss1 << std::hex << upper32ppinstr;
-    ss1 >> upper32ppin;
-
-    unsigned int lower32ppin;
-    std::stringstream ss2;
-    ss2 << std::hex << lower32ppinstr;
-    ss2 >> lower32ppin;
-
-    //Bits 0-13 are Dev Number
-    //mask out all 14 bits
-    int devnum = (lower32ppin & MASKNO_14BITS);
-    //add leading zeros to the string if less then 4 digit
-    std::string devnumstr = std::to_string(devnum);
-    std::ostringstream ss3;
-    ss3 << std::setw(DEV_LENGTH) << std::setfill('0') << devnumstr;
-    devnumstr = ss3.str();
-
-    //Bits 14-20 are Month/Year
-    int datecode = (lower32ppin & MASKNO_MON_YEAR);
-        datecode = (datecode >> DATECODE_SHIFT);
-
-    int month = (datecode / MONTH_VAL);
-        month = month + 1;
-
-    int year = datecode  % MONTH_VAL;
-    std::string monthstr = "";
-    if(months_map.find(month) != months_map.end())
+    for (const auto& prop : props)
     {
-       monthstr = months_map.find(month)->second;
+        try
+        {
+            CPU_INFO_DEBUG("Set the DBUS Property of %s \n", prop.name);
+            char path[PROC_PATH_LEN];
+            snprintf(path, sizeof(path), "%s%d", config.inventory_prefix.c_str(), prop.soc_num);
+
+            // built on sd-bus directly, sdbusplus would copy every name
+            // and value into std::string and std::variant temporaries
+            sd_bus_message *method = nullptr;
+            int ret = sd_bus_message_new_method_call(bus.get(), &method, INVENTORY_MANAGER, path,
+                                                     CpuInfoDataHolder::PropertiesIntf, "Set");
+            if (ret >= 0)
+            {
+                ret = append_property(method, prop);
+            }
+            if (ret >= 0)
+            {
+                // Floating slot, the reply is dispatched from the event loop
+                ret = sd_bus_call_async(bus.get(), nullptr, method, set_property_reply, this, 0);
+            }
+            sd_bus_message_unref(method);
+            if (ret < 0)
+            {
+                log_ratelimited(LOG_ERR, "Failed to queue Set of %s : %d \n", prop.name, ret);
+                if (stats)
+                {
+                    stats->set_failed();
+                }
+            }
+            else
+            {
+                outstanding_sets++;
+                if (stats)
+                {
+                    stats->set_issued();
+                }
+            }
+        }
+        catch (std::exception& e)
+        {
+            sd_journal_print(LOG_ERR, "Error in setting Dbus : %s \n", e.what());
+        }
     }
-
-    datemonthlotstr = monthstr + std::to_string(year) + devnumstr;
 }
-//decode marked lot number char length is 7 -Fuse/mak lot #
-void CpuInfo::decode_lotstring(char* ppinstr, std::string& markedlotstr)
-{
-    std::string ppin_str(ppinstr);
-    uint64_t full64ppin;
-    uint64_t markedlot;
-    uint64_t converter_num;
-    uint64_t decodechar_num;
-
-    //convert hex string to actual number
-    std::string ppin_hexstr = HEX + ppin_str;
-    std::stringstream ss;
-    ss << std::hex << ppin_hexstr;
-    ss >> full64ppin;
-
-    //Bits 21-57 are Marked Lot Number
-    markedlot = full64ppin >> LOTNUM_SHIFT;
 
-    converter_num = markedlot;
-    char currentchar[CMD_BUFF_LEN] = {0};
-
-    //Now convert Marked Lot through Alpha Numeric 37 decoding
-    //marked lot is 7 char string
-    for (int i = 0; i < LOTNUM_LENGTH; i++)
+// Host is off, its sockets do not answer APML any more
+void CpuInfo::stop_telemetry()
+{
+    if (!telemetry)
     {
-       decodechar_num = converter_num % MAX_ALPHA_NUM;
-       converter_num = converter_num / MAX_ALPHA_NUM;
-       if (decodechar_num < MAX_ALPHA_LENGTH)
-       {
-           decodechar_num = decodechar_num + ALPHA_CHAR_CONVER_VAL;
-           currentchar[i] = decodechar_num;
-       }
-       else
-       {
-           decodechar_num = decodechar_num + DIGIT_CONVER_VAL;
-           currentchar[i] = decodechar_num;
-       }
+        return;
     }
-    //reverse the char buffer to get lot number
-    int len, temp, itrlen;
-    len = strlen(currentchar);
-    itrlen = len / LENGTH_DIV;
-    for(int i = 0; i < itrlen; i++)
+    for (uint8_t soc_num = get_first_socket(); soc_num < get_first_socket() + MAX_SOCKETS_PER_HOST; soc_num++)
     {
-       temp = currentchar[i];
-       currentchar[i] = currentchar[len - i - 1];
-       currentchar[len - i - 1] = temp;
+        telemetry->set_active(soc_num, false, apml_socket(soc_num));
     }
-    markedlotstr = currentchar;
 }
-//decode PPIN to get SN
-void CpuInfo::decode_PPIN(uint8_t soc_num, uint64_t data)
-{
-    char ppinstr[CMD_BUFF_LEN] = {0};
-    char setppinstr[CMD_BUFF_LEN] = {0};
-    std::string markedlotstr;
-    std::string datemonthlotstr;
-    std::string serialnumstr;
-
-    sprintf(setppinstr, "0x%llx", data);
-    sd_journal_print(LOG_INFO, "PPIN Fuse : %s \n", setppinstr);
-    //convert char to string
-    std::string setppinstr_str(setppinstr);
-    set_cpu_string_value(soc_num, setppinstr_str, "PPIN", CPU_INTERFACE);
-
-    sprintf(ppinstr, "0%llx", data);
-    decode_lotstring(ppinstr, markedlotstr);
-    sd_journal_print(LOG_INFO, "Mark Lot string # %s \n", markedlotstr.c_str());
-
-    decode_datemonth_unitlot(ppinstr, datemonthlotstr);
-    sd_journal_print(LOG_INFO, "Month:Year:#Unitlot %s \n", datemonthlotstr.c_str());
-
-    //serial Number = lotstring + month + year + devnum
-    serialnumstr = markedlotstr + datemonthlotstr;
-
-    //now convert string to Char buffer to set in DBus
-    char serialnum_buffer[serialnumstr.length() + 1];
-    strcpy(serialnum_buffer, serialnumstr.c_str());
 
-    //set the Dbus property
-    std::string serialnum_buffer_str(serialnum_buffer);
-    set_cpu_string_value(soc_num, serialnum_buffer_str, "SerialNumber", ASSET_INTERFACE);
+// Walk the cores of every present socket on the background pool
+void CpuInfo::start_core_enumeration(const std::vector<uint8_t>& sockets)
+{
+    if (!background || enumerating || sockets.empty())
+    {
+        return;
+    }
+    enumerating = true;
 
-    return;
+    // sampling waits for the enumeration like for a collection
+    if (telemetry)
+    {
+        telemetry->bus_busy(true);
+    }
+    background->post([this, sockets]() {
+        for (uint8_t soc_num : sockets)
+        {
+            CoreMap map;
+            if (enumerate_cores(*apml, soc_num, apml_socket(soc_num), CORE_MAP_BUS_BUDGET_USEC,
+                                map))
+            {
+                pool.post_to_loop([this, map]() mutable {
+                    auto& object = core_maps[map.soc_num];
+                    if (!object)
+                    {
+                        object = std::make_unique<CoreMapObject>(bus, map.soc_num);
+                    }
+                    object->update(std::move(map));
+                });
+            }
+        }
+        pool.post_to_loop([this]() {
+            if (telemetry)
+            {
+                telemetry->bus_busy(false);
+            }
+            enumerating = false;
+        });
+    });
 }
@@ -0,0 +1,147 @@
+#include "cpu_info_shm_writer.hpp"
+
+#include <systemd/sd-journal.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+
+CpuShmWriter::~CpuShmWriter()
+{
+    if (header)
+        munmap(header, sizeof(CpuShmHeader));
+}
+
+bool CpuShmWriter::open(const char *path)
+{
+    if (mkdir(CPU_SHM_DIR, 0755) < 0 && errno != EEXIST)
+    {
+        sd_journal_print(LOG_ERR, "Failed to create %s : %d \n", CPU_SHM_DIR, errno);
+        return false;
+    }
+    int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        sd_journal_print(LOG_ERR, "Failed to open %s : %d \n", path, errno);
+        return false;
+    }
+    if (ftruncate(fd, sizeof(CpuShmHeader)) < 0)
+    {
+        sd_journal_print(LOG_ERR, "Failed to size %s : %d \n", path, errno);
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(nullptr, sizeof(CpuShmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        sd_journal_print(LOG_ERR, "Failed to map %s : %d \n", path, errno);
+        return false;
+    }
+    header = static_cast<CpuShmHeader *>(addr);
+
+    // a layout left over by another version is reset, readers check magic last
+    if (header->version != CPU_SHM_VERSION || header->size != sizeof(CpuShmHeader) ||
+        header->magic != CPU_SHM_MAGIC)
+    {
+        header->magic = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        memset((void *)header->slots, 0, sizeof(header->slots));
+        header->version = CPU_SHM_VERSION;
+        header->size = sizeof(CpuShmHeader);
+        header->num_sockets = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = CPU_SHM_MAGIC;
+    }
+    return true;
+}
+
+static void apply_property(CpuShmRecord& record, const PendingProperty& prop)
+{
+    int field = 0;
+    while (field < SHM_FIELD_COUNT && strcmp(prop.name, cpu_shm_field_names[field]))
+        field++;
+    if (field == SHM_FIELD_COUNT)
+        return;
+
+    if (field < SHM_STRING_FIELDS)
+    {
+        const PropertyString *str = std::get_if<PropertyString>(&prop.value);
+        if (!str)
+            return;
+        snprintf(record.strings[field], CPU_SHM_STR_LEN, "%s", str->str);
+    }
+    else if (field == SHM_MAX_SPEED)
+        record.max_speed_mhz = std::get<uint32_t>(prop.value);
+    else if (field == SHM_THREAD_COUNT)
+        record.thread_count = std::get<uint16_t>(prop.value);
+    else if (field == SHM_CORE_COUNT)
+        record.core_count = std::get<uint16_t>(prop.value);
+    else
+        record.present = std::get<bool>(prop.value);
+    record.valid |= (1u << field);
+}
+
+void CpuShmWriter::replace(uint8_t soc_num, bool present,
+                           const std::vector<PendingProperty>& props)
+{
+    write(soc_num, props, true, present);
+}
+
+void CpuShmWriter::update(uint8_t soc_num, const std::vector<PendingProperty>& props)
+{
+    write(soc_num, props, false, false);
+}
+
+// Apply the properties of one socket under its seqlock. A full write
+// starts from an empty record so that no field of an earlier CPU survives.
+void CpuShmWriter::write(uint8_t soc_num, const std::vector<PendingProperty>& props, bool full,
+                         bool present)
+{
+    if (!header || soc_num >= CPU_SHM_MAX_SOCKETS)
+        return;
+
+    CpuShmSlot& slot = header->slots[soc_num];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (full)
+    {
+        CpuShmRecord& record = slot.record;
+        record.valid = (1u << SHM_PRESENT);
+        record.present = present;
+        record.max_speed_mhz = 0;
+        record.thread_count = 0;
+        record.core_count = 0;
+        memset(record.strings, 0, sizeof(record.strings));
+    }
+    for (const auto& prop : props)
+    {
+        if (prop.soc_num == soc_num)
+            apply_property(slot.record, prop);
+    }
+    slot.record.generation++;
+    slot.record.updated_usec = now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+
+    if (soc_num >= header->num_sockets)
+        header->num_sockets = soc_num + 1;
+}
+
+bool CpuShmWriter::has_record(uint8_t soc_num) const
+{
+    return header && soc_num < CPU_SHM_MAX_SOCKETS &&
+           header->slots[soc_num].record.generation != 0;
+}
+
+CpuShmRecord CpuShmWriter::record(uint8_t soc_num) const
+{
+    if (!header || soc_num >= CPU_SHM_MAX_SOCKETS)
+        return CpuShmRecord{};
+    return header->slots[soc_num].record;
+}
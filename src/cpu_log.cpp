@@ -0,0 +1,74 @@
+#include "cpu_log.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace
+{
+
+struct RateSite
+{
+    const char *fmt;
+    uint64_t window_start;
+    unsigned int logged;
+    unsigned int dropped;
+};
+
+std::mutex site_lock;
+RateSite sites[LOG_RATE_SITES];
+
+uint64_t now_sec()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+int log_ratelimited_v(int priority, const char *fmt, va_list args)
+{
+    unsigned int dropped = 0;
+    {
+        std::lock_guard<std::mutex> guard(site_lock);
+        uint64_t now = now_sec();
+        RateSite *site = nullptr;
+        for (auto& entry : sites)
+        {
+            if (entry.fmt == fmt || entry.fmt == nullptr)
+            {
+                site = &entry;
+                break;
+            }
+        }
+        // table full, better to log than to lose a new kind of error
+        if (site)
+        {
+            if (site->fmt == nullptr || now - site->window_start >= LOG_RATE_INTERVAL_SEC)
+            {
+                dropped = site->dropped;
+                *site = RateSite{fmt, now, 0, 0};
+            }
+            if (site->logged >= LOG_RATE_BURST)
+            {
+                site->dropped++;
+                return 0;
+            }
+            site->logged++;
+        }
+    }
+    if (dropped)
+    {
+        sd_journal_print(priority, "%u similar messages suppressed \n", dropped);
+    }
+    return sd_journal_printv(priority, fmt, args);
+}
+
+int log_ratelimited(int priority, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int ret = log_ratelimited_v(priority, fmt, args);
+    va_end(args);
+    return ret;
+}
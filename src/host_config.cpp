@@ -0,0 +1,174 @@
+#include "host_config.hpp"
+#include "cpu_info_shm.hpp"
+
+#include <systemd/sd-journal.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#define COMMAND_PRINTENV   ("/sbin/fw_printenv 2>/dev/null")
+#define ENV_LINE_LEN       (256)
+#define GPIO_NAME_LEN      (32)
+// room left in PROC_PATH_LEN for the <n> of a processor
+#define PROC_NUM_LEN       (4)
+
+using Environment = std::map<std::string, std::string>;
+
+// name=value lines of fw_printenv, empty when it is not there
+static Environment read_environment()
+{
+    Environment env;
+    char line[ENV_LINE_LEN];
+
+    FILE *pf = popen(COMMAND_PRINTENV, "r");
+    if (pf == NULL)
+    {
+        sd_journal_print(LOG_ERR, "Failed to open command stream \n");
+        return env;
+    }
+    while (fgets(line, sizeof(line), pf) != NULL)
+    {
+        char *value = strchr(line, '=');
+        if (value == NULL)
+        {
+            continue;
+        }
+        *value++ = '\0';
+        value[strcspn(value, "\n")] = '\0';
+        env[line] = value;
+    }
+    pclose(pf);
+    return env;
+}
+
+// false when name is not set, or is not a number up to max
+static bool env_number(const Environment& env, const std::string& name, unsigned long max,
+                       uint8_t& value)
+{
+    auto entry = env.find(name);
+    char *end;
+
+    if (entry == env.end())
+    {
+        return false;
+    }
+    unsigned long number = strtoul(entry->second.c_str(), &end, 10);
+    if (entry->second.empty() || *end || number > max)
+    {
+        sd_journal_print(LOG_ERR, "Ignoring %s=%s \n", name.c_str(), entry->second.c_str());
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+// P<n>_PRESENT_L for the P<n> of each socket
+static void name_present_gpios(HostConfig& config)
+{
+    for (int i = 0; i < MAX_SOCKETS_PER_HOST; i++)
+    {
+        char name[GPIO_NAME_LEN];
+        snprintf(name, sizeof(name), PRESENT_GPIO_FMT, config.inventory_base + i);
+        config.present_gpios[i] = name;
+    }
+}
+
+HostConfig default_host_config(uint8_t host_num)
+{
+    HostConfig config;
+
+    config.inventory_base = host_num * MAX_SOCKETS_PER_HOST;
+    name_present_gpios(config);
+    return config;
+}
+
+static HostConfig load_host_config(const Environment& env, uint8_t host_num)
+{
+    HostConfig config = default_host_config(host_num);
+    std::string prefix = "host" + std::to_string(host_num) + "_";
+
+    if (!env_number(env, prefix + "num_of_cpu", MAX_SOCKETS_PER_HOST, config.num_of_cpu) &&
+        !env_number(env, "num_of_cpu", MAX_SOCKETS_PER_HOST, config.num_of_cpu))
+    {
+        config.num_of_cpu = 1;
+    }
+    if (config.num_of_cpu == 0)
+    {
+        config.num_of_cpu = 1;
+    }
+    env_number(env, prefix + "apml_base", UINT8_MAX - MAX_SOCKETS_PER_HOST, config.apml_base);
+    // the P<n> of every socket must have a snapshot slot
+    if (env_number(env, prefix + "inventory_base", CPU_SHM_MAX_SOCKETS - MAX_SOCKETS_PER_HOST,
+                   config.inventory_base))
+    {
+        name_present_gpios(config);
+    }
+    auto inventory_prefix = env.find(prefix + "inventory_prefix");
+    if (inventory_prefix != env.end())
+    {
+        if (inventory_prefix->second.size() + PROC_NUM_LEN < PROC_PATH_LEN)
+        {
+            config.inventory_prefix = inventory_prefix->second;
+        }
+        else
+        {
+            sd_journal_print(LOG_ERR, "Ignoring %sinventory_prefix, too long \n", prefix.c_str());
+        }
+    }
+    auto gpios = env.find(prefix + "present_gpios");
+    if (gpios != env.end())
+    {
+        size_t start = 0;
+        for (int i = 0; i < MAX_SOCKETS_PER_HOST && start <= gpios->second.size(); i++)
+        {
+            size_t end = gpios->second.find(',', start);
+            if (end == std::string::npos)
+            {
+                end = gpios->second.size();
+            }
+            if (end > start)
+            {
+                config.present_gpios[i] = gpios->second.substr(start, end - start);
+            }
+            start = end + 1;
+        }
+    }
+    return config;
+}
+
+std::vector<HostConfig> load_host_configs(unsigned int num_of_hosts)
+{
+    Environment env = read_environment();
+    std::vector<HostConfig> configs;
+    uint32_t used = 0;
+
+    for (unsigned int host_num = 0; host_num < num_of_hosts; host_num++)
+    {
+        HostConfig config = load_host_config(env, host_num);
+        uint32_t sockets = ((1u << config.num_of_cpu) - 1) << config.inventory_base;
+        // two hosts on one P<n> would overwrite each other's inventory, move
+        // to the first free processors
+        if (used & sockets)
+        {
+            uint8_t base = 0;
+            while ((used & (((1u << config.num_of_cpu) - 1) << base)) &&
+                   base + config.num_of_cpu < CPU_SHM_MAX_SOCKETS)
+            {
+                base++;
+            }
+            sd_journal_print(LOG_ERR, "host%d inventory P%d is taken, using P%d \n",
+                             host_num, config.inventory_base, base);
+            config.inventory_base = base;
+            sockets = ((1u << config.num_of_cpu) - 1) << base;
+        }
+        used |= sockets;
+        sd_journal_print(LOG_INFO, "host%d: %d sockets, APML %d, inventory %s%d, presence %s \n",
+                         host_num, config.num_of_cpu, config.apml_base,
+                         config.inventory_prefix.c_str(), config.inventory_base,
+                         config.present_gpios[0].c_str());
+        configs.push_back(config);
+    }
+    return configs;
+}
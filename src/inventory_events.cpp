@@ -0,0 +1,158 @@
+#include "inventory_events.hpp"
+
+#include <systemd/sd-journal.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Fields that tell one CPU from another, a change means a swap or an update
+static const CpuShmField identity_fields[IDENTITY_FIELD_COUNT] = {
+    SHM_PPIN, SHM_SERIAL_NUMBER, SHM_PART_NUMBER, SHM_MICROCODE};
+
+const sd_bus_vtable InventoryEvents::vtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::signal(INVENTORY_CHANGED, "uasasas"),
+    sdbusplus::vtable::end()};
+
+InventoryEvents::InventoryEvents(sdbusplus::bus::bus &bus, const char *path) :
+    path(path), bus(bus), intf(bus, DBUS_OBJECT_NAME, INVENTORY_EVENTS_INTF, vtable, this)
+{
+    load();
+}
+
+// one line per known field: <socket> <field index> <value>
+void InventoryEvents::load()
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    char line[CPU_SHM_STR_LEN + 16];
+
+    if (fp == NULL)
+    {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        unsigned int soc_num, i;
+        int offset;
+        if (sscanf(line, "%u %u %n", &soc_num, &i, &offset) != 2 ||
+            soc_num >= CPU_SHM_MAX_SOCKETS || i >= IDENTITY_FIELD_COUNT)
+        {
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        Identity& identity = identities[soc_num];
+        identity.seeded = true;
+        identity.known[i] = true;
+        snprintf(identity.values[i], CPU_SHM_STR_LEN, "%s", line + offset);
+    }
+    fclose(fp);
+}
+
+void InventoryEvents::save()
+{
+    std::string tmp = path + ".tmp";
+    FILE *fp;
+
+    if (mkdir(APML_CAPS_DIR, 0755) < 0 && errno != EEXIST)
+    {
+        sd_journal_print(LOG_ERR, "Failed to create %s : %d \n", APML_CAPS_DIR, errno);
+        return;
+    }
+    fp = fopen(tmp.c_str(), "w");
+    if (fp == NULL)
+    {
+        sd_journal_print(LOG_ERR, "Failed to write %s : %d \n", tmp.c_str(), errno);
+        return;
+    }
+    for (int soc_num = 0; soc_num < CPU_SHM_MAX_SOCKETS; soc_num++)
+    {
+        for (int i = 0; i < IDENTITY_FIELD_COUNT; i++)
+        {
+            if (identities[soc_num].known[i])
+            {
+                fprintf(fp, "%d %d %s\n", soc_num, i, identities[soc_num].values[i]);
+            }
+        }
+    }
+    if (fclose(fp) != 0 || rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        sd_journal_print(LOG_ERR, "Failed to save %s : %d \n", path.c_str(), errno);
+    }
+}
+
+void InventoryEvents::compare(uint8_t soc_num, const CpuShmRecord& before,
+                              const CpuShmRecord& after, uint32_t read)
+{
+    std::vector<std::string> fields;
+    std::vector<std::string> old_values;
+    std::vector<std::string> new_values;
+
+    if (soc_num >= CPU_SHM_MAX_SOCKETS)
+    {
+        return;
+    }
+    // the baseline is the stored identity, else what the snapshot held
+    Identity& identity = identities[soc_num];
+    bool dirty = false;
+    if (!identity.seeded)
+    {
+        identity.seeded = true;
+        for (int i = 0; i < IDENTITY_FIELD_COUNT; i++)
+        {
+            CpuShmField field = identity_fields[i];
+            identity.known[i] = before.generation != 0 && (before.valid & (1u << field));
+            snprintf(identity.values[i], CPU_SHM_STR_LEN, "%s",
+                     identity.known[i] ? before.strings[field] : "");
+        }
+    }
+
+    for (int i = 0; i < IDENTITY_FIELD_COUNT; i++)
+    {
+        CpuShmField field = identity_fields[i];
+        uint32_t bit = 1u << field;
+        // a field this collection failed to read keeps its last value
+        if (!(read & bit) || !(after.valid & bit))
+        {
+            continue;
+        }
+        const char *value = after.strings[field];
+        if (identity.known[i] && !strncmp(identity.values[i], value, CPU_SHM_STR_LEN))
+        {
+            continue;
+        }
+        if (identity.known[i])
+        {
+            fields.emplace_back(cpu_shm_field_names[field]);
+            old_values.emplace_back(identity.values[i]);
+            new_values.emplace_back(value);
+        }
+        dirty = true;
+        identity.known[i] = true;
+        snprintf(identity.values[i], CPU_SHM_STR_LEN, "%s", value);
+    }
+    // written only when the identity moves, not on every collection
+    if (dirty)
+    {
+        save();
+    }
+    if (fields.empty())
+    {
+        return;
+    }
+
+    sd_journal_print(LOG_NOTICE, "P%d identity changed, %zu fields \n", soc_num, fields.size());
+    try
+    {
+        auto signal = bus.new_signal(DBUS_OBJECT_NAME, INVENTORY_EVENTS_INTF, INVENTORY_CHANGED);
+        signal.append(static_cast<uint32_t>(soc_num), fields, old_values, new_values);
+        signal.signal_send();
+    }
+    catch (std::exception& e)
+    {
+        sd_journal_print(LOG_ERR, "Failed to emit %s : %s \n", INVENTORY_CHANGED, e.what());
+    }
+}
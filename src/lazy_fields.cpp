@@ -0,0 +1,356 @@
+#include "cpu_info.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+// D-Bus name of every lazy field, the step that reads it and its snapshot slot
+static const struct
+{
+    const char *name;
+    LazyStep step;
+    CpuShmField field;
+} lazy_field_map[] = {
+    {"PPIN", LAZY_PPIN, SHM_PPIN},
+    {"SerialNumber", LAZY_PPIN, SHM_SERIAL_NUMBER},
+    {"PartNumber", LAZY_OPN, SHM_PART_NUMBER},
+};
+
+#define ALL_LAZY_STEPS  ((1u << LAZY_STEP_COUNT) - 1)
+
+// The values are read on demand, on the first read of a property or
+// through Fetch. PropertiesChanged only invalidates them, so that emitting
+// it does not start a read.
+const sd_bus_vtable LazyFieldsObject::vtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::property("PPIN", "s", LazyFieldsObject::get_property,
+                                sdbusplus::vtable::property_::emits_invalidation),
+    sdbusplus::vtable::property("SerialNumber", "s", LazyFieldsObject::get_property,
+                                sdbusplus::vtable::property_::emits_invalidation),
+    sdbusplus::vtable::property("PartNumber", "s", LazyFieldsObject::get_property,
+                                sdbusplus::vtable::property_::emits_invalidation),
+    sdbusplus::vtable::property("Pending", "as", LazyFieldsObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::method("Fetch", "as", "", LazyFieldsObject::fetch),
+    sdbusplus::vtable::end()};
+
+LazyFieldsObject::LazyFieldsObject(sdbusplus::bus::bus &bus, uint8_t soc_num, CpuInfo &owner) :
+    soc_num(soc_num), owner(owner),
+    path(std::string(DBUS_OBJECT_NAME) + "/P" + std::to_string(soc_num)),
+    intf(bus, path.c_str(), LAZY_FIELDS_INTF, vtable, this)
+{
+}
+
+void LazyFieldsObject::changed(LazyStep step)
+{
+    for (const auto& entry : lazy_field_map)
+    {
+        if (entry.step == step)
+        {
+            intf.property_changed(entry.name);
+        }
+    }
+    intf.property_changed("Pending");
+}
+
+int LazyFieldsObject::get_property(sd_bus *bus, const char *path, const char *interface,
+                                   const char *property, sd_bus_message *reply,
+                                   void *userdata, sd_bus_error *error)
+{
+    LazyFieldsObject *self = static_cast<LazyFieldsObject *>(userdata);
+
+    if (!strcmp(property, "Pending"))
+    {
+        const char *names[sizeof(lazy_field_map) / sizeof(lazy_field_map[0]) + 1] = {};
+        uint8_t unfetched = self->owner.lazy_unfetched(self->soc_num);
+        int count = 0;
+        for (const auto& entry : lazy_field_map)
+        {
+            if (unfetched & (1u << entry.step))
+            {
+                names[count++] = entry.name;
+            }
+        }
+        return sd_bus_message_append_strv(reply, const_cast<char **>(names));
+    }
+    for (const auto& entry : lazy_field_map)
+    {
+        if (strcmp(property, entry.name))
+        {
+            continue;
+        }
+        // first read starts the APML read, shared with any read already
+        // queued. The caller retries once the invalidation is emitted.
+        if (!self->owner.lazy_fetched(self->soc_num, entry.step))
+        {
+            if (!self->owner.request_lazy(self->soc_num, entry.step))
+            {
+                return sd_bus_error_setf(error, LAZY_UNAVAILABLE, "P%d did not answer over APML",
+                                         self->soc_num);
+            }
+            return sd_bus_error_setf(error, LAZY_UNAVAILABLE,
+                                     "%s of P%d is being read over APML, retry", entry.name,
+                                     self->soc_num);
+        }
+        CpuShmRecord record = self->owner.lazy_record(self->soc_num);
+        return sd_bus_message_append(reply, "s", record.strings[entry.field]);
+    }
+    return -EINVAL;
+}
+
+// Fetch(as fields), replies once every field was read, all fields when empty
+int LazyFieldsObject::fetch(sd_bus_message *msg, void *userdata, sd_bus_error *error)
+{
+    LazyFieldsObject *self = static_cast<LazyFieldsObject *>(userdata);
+    char **fields = nullptr;
+    uint8_t steps = 0;
+    bool valid = true;
+
+    int ret = sd_bus_message_read_strv(msg, &fields);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    for (char **field = fields; field && *field; field++)
+    {
+        bool known = false;
+        for (const auto& entry : lazy_field_map)
+        {
+            if (!strcmp(*field, entry.name))
+            {
+                steps |= (1u << entry.step);
+                known = true;
+            }
+        }
+        valid = valid && known;
+        free(*field);
+    }
+    free(fields);
+
+    if (!valid)
+    {
+        sd_bus_error_set_const(error, SD_BUS_ERROR_INVALID_ARGS, "Unknown lazy field");
+        return -EINVAL;
+    }
+    return self->owner.fetch_lazy(msg, self->soc_num, steps ? steps : ALL_LAZY_STEPS);
+}
+
+uint32_t CpuInfo::lazy_step_fields(LazyStep step)
+{
+    uint32_t fields = 0;
+    for (const auto& entry : lazy_field_map)
+    {
+        if (entry.step == step)
+        {
+            fields |= (1u << entry.field);
+        }
+    }
+    return fields;
+}
+
+uint32_t CpuInfo::collection_fields() const
+{
+    uint32_t fields = (1u << SHM_FIELD_COUNT) - 1;
+    if (lazy)
+    {
+        for (int step = 0; step < LAZY_STEP_COUNT; step++)
+        {
+            fields &= ~lazy_step_fields(static_cast<LazyStep>(step));
+        }
+    }
+    return fields;
+}
+
+bool CpuInfo::lazy_fetched(uint8_t soc_num, LazyStep step) const
+{
+    return lazy_state[soc_num - get_first_socket()][step] == LAZY_DONE;
+}
+
+uint8_t CpuInfo::lazy_unfetched(uint8_t soc_num) const
+{
+    uint8_t steps = 0;
+    for (int step = 0; step < LAZY_STEP_COUNT; step++)
+    {
+        if (lazy_state[soc_num - get_first_socket()][step] != LAZY_DONE)
+        {
+            steps |= (1u << step);
+        }
+    }
+    return steps;
+}
+
+bool CpuInfo::request_lazy(uint8_t soc_num, LazyStep step)
+{
+    uint8_t index = soc_num - get_first_socket();
+
+    if (!(lazy_present & (1u << index)))
+    {
+        return false;
+    }
+    // queued or in flight already, the caller shares that read
+    if (lazy_state[index][step] == LAZY_PENDING)
+    {
+        lazy_state[index][step] = LAZY_QUEUED;
+    }
+    run_lazy();
+    return true;
+}
+
+int CpuInfo::fetch_lazy(sd_bus_message *msg, uint8_t soc_num, uint8_t steps)
+{
+    if (!(lazy_present & (1u << (soc_num - get_first_socket()))))
+    {
+        return sd_bus_reply_method_errorf(msg, LAZY_UNAVAILABLE, "P%d did not answer over APML",
+                                          soc_num);
+    }
+    lazy_waiters.push_back({sd_bus_message_ref(msg), soc_num, steps});
+    for (int step = 0; step < LAZY_STEP_COUNT; step++)
+    {
+        if (steps & (1u << step))
+        {
+            request_lazy(soc_num, static_cast<LazyStep>(step));
+        }
+    }
+    reply_lazy_waiters();
+    return 1;
+}
+
+// Run the next queued lazy read unless the host already has an APML job
+void CpuInfo::run_lazy()
+{
+    if (collecting || fetching)
+    {
+        return;
+    }
+    for (uint8_t index = 0; index < MAX_SOCKETS_PER_HOST; index++)
+    {
+        for (int step = 0; step < LAZY_STEP_COUNT; step++)
+        {
+            if (lazy_state[index][step] != LAZY_QUEUED)
+            {
+                continue;
+            }
+            uint8_t soc_num = get_first_socket() + index;
+            lazy_state[index][step] = LAZY_FETCHING;
+            fetching = true;
+
+            pool.post([this, soc_num, step]() {
+                pending.clear();
+                timings.clear();
+                bool ok = collect_lazy(soc_num, static_cast<LazyStep>(step));
+                pool.post_to_loop([this, soc_num, step, ok]() {
+                    uint8_t index = soc_num - get_first_socket();
+                    record_snapshot(soc_num, false, true,
+                                    lazy_step_fields(static_cast<LazyStep>(step)));
+                    publish(pending);
+                    // a failed read is tried again on the next request
+                    lazy_state[index][step] = ok ? LAZY_DONE : LAZY_PENDING;
+                    fetching = false;
+                    lazy_fields[soc_num]->changed(static_cast<LazyStep>(step));
+                    reply_lazy_waiters();
+                    if (recollect)
+                    {
+                        start_collection();
+                    }
+                    else
+                    {
+                        run_lazy();
+                    }
+                });
+            }, host_num);
+            return;
+        }
+    }
+}
+
+// A new collection may have seen another CPU, earlier reads are stale
+void CpuInfo::lazy_collected(const std::vector<uint8_t>& sockets)
+{
+    if (!lazy)
+    {
+        return;
+    }
+    lazy_present = 0;
+    for (uint8_t soc_num : sockets)
+    {
+        lazy_present |= (1u << (soc_num - get_first_socket()));
+    }
+    for (uint8_t index = 0; index < MAX_SOCKETS_PER_HOST; index++)
+    {
+        uint8_t soc_num = get_first_socket() + index;
+        bool answered = lazy_present & (1u << index);
+        for (int step = 0; step < LAZY_STEP_COUNT; step++)
+        {
+            // queued reads of a socket still there run after the collection
+            if (!answered || lazy_state[index][step] == LAZY_DONE)
+            {
+                lazy_state[index][step] = LAZY_PENDING;
+            }
+        }
+        if (answered)
+        {
+            auto& object = lazy_fields[soc_num];
+            if (!object)
+            {
+                object = std::make_unique<LazyFieldsObject>(bus, soc_num, *this);
+            }
+            for (int step = 0; step < LAZY_STEP_COUNT; step++)
+            {
+                object->changed(static_cast<LazyStep>(step));
+            }
+        }
+    }
+    reply_lazy_waiters();
+}
+
+// Sockets stop answering, queued reads are dropped and their callers told
+void CpuInfo::lazy_host_off()
+{
+    lazy_present = 0;
+    for (auto& steps : lazy_state)
+    {
+        for (auto& state : steps)
+        {
+            if (state == LAZY_QUEUED)
+            {
+                state = LAZY_PENDING;
+            }
+        }
+    }
+    reply_lazy_waiters();
+}
+
+void CpuInfo::reply_lazy_waiters()
+{
+    for (auto waiter = lazy_waiters.begin(); waiter != lazy_waiters.end();)
+    {
+        uint8_t index = waiter->soc_num - get_first_socket();
+        bool busy = false;
+        bool done = true;
+        for (int step = 0; step < LAZY_STEP_COUNT; step++)
+        {
+            if (!(waiter->steps & (1u << step)))
+            {
+                continue;
+            }
+            busy = busy || lazy_state[index][step] == LAZY_QUEUED ||
+                   lazy_state[index][step] == LAZY_FETCHING;
+            done = done && lazy_state[index][step] == LAZY_DONE;
+        }
+        if (busy)
+        {
+            ++waiter;
+            continue;
+        }
+        if (done)
+        {
+            sd_bus_reply_method_return(waiter->msg, "");
+        }
+        else
+        {
+            sd_bus_reply_method_errorf(waiter->msg, LAZY_UNAVAILABLE,
+                                       "P%d could not be read over APML", waiter->soc_num);
+        }
+        sd_bus_message_unref(waiter->msg);
+        waiter = lazy_waiters.erase(waiter);
+    }
+}
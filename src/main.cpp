@@ -1,12 +1,143 @@
 #include "cpu_info.hpp"
+#include "oneshot.hpp"
+#include "telemetry_dbus.hpp"
 
-int main()
+#include <getopt.h>
+#include <cerrno>
+#include <cmath>
+
+#define COMMAND_NUM_OF_HOSTS  ("/sbin/fw_printenv -n num_of_hosts 2>/dev/null")
+#define COMMAND_LEN           (3)
+#define MAX_NUM_OF_HOSTS      (8)
+#define MAX_WORKER_THREADS    (4)
+
+//get the number of host nodes managed by this BMC, default 1
+static unsigned int getNumberOfHosts()
 {
-    CpuInfoDataHolder* cpuinfoDataHolderObj =
-        cpuinfoDataHolderObj->getInstance();
+    FILE *pf;
+    char data[COMMAND_LEN];
+    unsigned int num_of_hosts = 1;
+
+    pf = popen(COMMAND_NUM_OF_HOSTS, "r");
+    if (pf != NULL)
+    {
+        if (fgets(data, COMMAND_LEN, pf) != NULL)
+        {
+            num_of_hosts = strtoul(data, NULL, 10);
+        }
+        pclose(pf);
+    }
+    if (num_of_hosts == 0 || num_of_hosts > MAX_NUM_OF_HOSTS)
+    {
+        num_of_hosts = 1;
+    }
+    return num_of_hosts;
+}
 
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--oneshot [--sockets 1-%d] [--json]]\n"
+                    "       [--apml-record FILE | --apml-replay FILE [--apml-time-scale S]]\n",
+            name, MAX_SOCKETS_PER_HOST);
+}
+
+int main(int argc, char **argv)
+{
     int ret = 0;
     std::string intfName;
+    bool oneshot = false;
+    bool json = false;
+    char *end;
+    unsigned int num_sockets = 0;
+    const char *apml_record = nullptr;
+    const char *apml_replay = nullptr;
+    double time_scale = 1.0;
+
+    static const struct option long_options[] = {
+        {"oneshot", no_argument, nullptr, 'o'},
+        {"sockets", required_argument, nullptr, 's'},
+        {"json", no_argument, nullptr, 'j'},
+        {"apml-record", required_argument, nullptr, 'r'},
+        {"apml-replay", required_argument, nullptr, 'p'},
+        {"apml-time-scale", required_argument, nullptr, 't'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                oneshot = true;
+                break;
+            case 's':
+                errno = 0;
+                num_sockets = strtoul(optarg, &end, 10);
+                if (errno || end == optarg || *end || num_sockets == 0 ||
+                    num_sockets > MAX_SOCKETS_PER_HOST)
+                {
+                    fprintf(stderr, "Invalid socket count %s \n", optarg);
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'j':
+                json = true;
+                break;
+            case 'r':
+                apml_record = optarg;
+                break;
+            case 'p':
+                apml_replay = optarg;
+                break;
+            case 't':
+                errno = 0;
+                time_scale = strtod(optarg, &end);
+                if (errno || end == optarg || *end || !std::isfinite(time_scale) ||
+                    time_scale < 0)
+                {
+                    fprintf(stderr, "Invalid APML time scale %s \n", optarg);
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (apml_record && apml_replay)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    // libapml calls of the collection, optionally recorded to or replayed
+    // from a trace file
+    std::unique_ptr<ApmlBackend> trace;
+    if (apml_record)
+    {
+        auto recorder = std::make_unique<RecordingBackend>(libapml_backend(), apml_record);
+        if (!recorder->is_open())
+        {
+            return -1;
+        }
+        trace = std::move(recorder);
+    }
+    else if (apml_replay)
+    {
+        auto replay = std::make_unique<ReplayBackend>(apml_replay, time_scale);
+        if (!replay->is_open())
+        {
+            return -1;
+        }
+        trace = std::move(replay);
+    }
+    ApmlBackend *apml = trace ? trace.get() : &libapml_backend();
+
+    if (oneshot)
+    {
+        return run_oneshot(num_sockets, json, apml);
+    }
 
     phosphor::logging::log<phosphor::logging::level::INFO>(
         "Start cpu info service...");
@@ -27,10 +158,61 @@ int main()
     intfName = DBUS_INTF_NAME;
     bus.request_name(intfName.c_str());
 
-    CpuInfo cpuInfo{bus, DBUS_OBJECT_NAME, eventP};
+    unsigned int num_of_hosts = getNumberOfHosts();
+    sd_journal_print(LOG_INFO, "Number of hosts %d\n", num_of_hosts);
 
+    CpuShmWriter snapshot;
+    if (!snapshot.open())
+    {
+        sd_journal_print(LOG_ERR, "CPU inventory snapshot is not available \n");
+    }
+
+    // used from the workers, must outlive the pool
+    ApmlCapabilities caps;
+
+    // declared ahead of the pool so workers are joined before hosts go away
+    std::vector<std::unique_ptr<CpuInfo>> cpuInfo;
     try
     {
+        // worker jobs report to these, declared ahead of the pools so that
+        // the workers are joined before they go away
+        ServiceNotifier notifier{eventP.get(), num_of_hosts};
+        InventoryEvents events{bus};
+        CollectionStats stats{bus};
+
+        // APML work is bus bound, one worker per host up to a small cap
+        WorkerPool pool{eventP.get(), std::min(num_of_hosts, (unsigned int)MAX_WORKER_THREADS)};
+#ifdef ENABLE_CORE_MAP
+        // single low priority thread, core enumeration never competes
+        // with the inventory collection for the worker pool
+        WorkerPool background{eventP.get(), 1};
+        WorkerPool *backgroundP = &background;
+#else
+        WorkerPool *backgroundP = nullptr;
+#endif
+        CpuInfoServices services{pool, snapshot, backgroundP};
+        services.notifier = &notifier;
+        services.caps = &caps;
+        services.apml = apml;
+        services.event = eventP.get();
+        services.events = &events;
+        stats.watch_pool(&pool);
+        services.stats = &stats;
+#ifdef ENABLE_TELEMETRY
+        TelemetryService telemetry{bus, pool, TELEMETRY_PERIOD_MS, apml};
+        services.telemetry = &telemetry.get_sampler();
+#endif
+
+        std::vector<HostConfig> configs = load_host_configs(num_of_hosts);
+        for (unsigned int host = 0; host < num_of_hosts; host++)
+        {
+            cpuInfo.emplace_back(std::make_unique<CpuInfo>(bus, host, configs[host], services));
+        }
+        for (auto& info : cpuInfo)
+        {
+            info->init_host_state();
+        }
+
         bus.attach_event(eventP.get(), SD_EVENT_PRIORITY_NORMAL);
         ret = sd_event_loop(eventP.get());
         if (ret < 0)
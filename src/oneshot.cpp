@@ -0,0 +1,182 @@
+#include "oneshot.hpp"
+#include "cpu_collector.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+struct OneshotCollector : public CpuCollector
+{
+    using CpuCollector::CpuCollector;
+};
+
+static void print_json_string(const char *str)
+{
+    putchar('"');
+    for (; *str; str++)
+    {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\')
+        {
+            printf("\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            printf("\\u%04x", c);
+        }
+        else
+        {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_json_value(const PropertyValue& value)
+{
+    if (auto str = std::get_if<PropertyString>(&value))
+        print_json_string(str->str);
+    else if (auto u32 = std::get_if<uint32_t>(&value))
+        printf("%u", *u32);
+    else if (auto u16 = std::get_if<uint16_t>(&value))
+        printf("%u", *u16);
+    else
+        printf("%s", std::get<bool>(value) ? "true" : "false");
+}
+
+// present means the socket answered APML, not merely that it is not
+// reported absent by its GPIO
+static bool socket_present(unsigned int soc_num, const OneshotCollector& collector)
+{
+    return std::find(collector.present.begin(), collector.present.end(), soc_num) !=
+           collector.present.end();
+}
+
+static void print_socket(unsigned int soc_num, const OneshotCollector& collector, uint64_t usec)
+{
+    bool present = socket_present(soc_num, collector);
+
+    printf("    {\n      \"socket\": %u,\n      \"present\": %s,\n      \"total_usec\": %llu,\n",
+           soc_num, present ? "true" : "false", (unsigned long long)usec);
+
+    printf("      \"fields\": {");
+    const char *sep = "";
+    for (const auto& prop : collector.pending)
+    {
+        printf("%s\n        ", sep);
+        print_json_string(prop.name);
+        printf(": ");
+        print_json_value(prop.value);
+        sep = ",";
+    }
+    printf("\n      },\n");
+
+    printf("      \"timings_usec\": {");
+    sep = "";
+    for (const auto& timing : collector.timings)
+    {
+        printf("%s\n        \"%s\": %llu", sep, timing.step, (unsigned long long)timing.usec);
+        sep = ",";
+    }
+    printf("\n      }\n    }");
+}
+
+static void print_text_value(const PropertyValue& value)
+{
+    if (auto str = std::get_if<PropertyString>(&value))
+        printf("%s", str->str);
+    else if (auto u32 = std::get_if<uint32_t>(&value))
+        printf("%u", *u32);
+    else if (auto u16 = std::get_if<uint16_t>(&value))
+        printf("%u", *u16);
+    else
+        printf("%s", std::get<bool>(value) ? "true" : "false");
+}
+
+static void print_socket_text(unsigned int soc_num, const OneshotCollector& collector,
+                              uint64_t usec)
+{
+    printf("P%u: %s, %llu us\n", soc_num,
+           socket_present(soc_num, collector) ? "present" : "absent", (unsigned long long)usec);
+    for (const auto& prop : collector.pending)
+    {
+        printf("  %-16s ", prop.name);
+        print_text_value(prop.value);
+        putchar('\n');
+    }
+    for (const auto& timing : collector.timings)
+    {
+        printf("  %-16s %llu us\n", timing.step, (unsigned long long)timing.usec);
+    }
+}
+
+int run_oneshot(unsigned int num_sockets, bool json, ApmlBackend *apml)
+{
+    auto begin = std::chrono::steady_clock::now();
+
+    // the APML sockets and presence lines of host0, reported as 0 and 1
+    HostConfig config = load_host_configs(1)[0];
+    config.inventory_base = 0;
+    if (num_sockets == 0)
+    {
+        num_sockets = config.num_of_cpu;
+    }
+    if (num_sockets > MAX_SOCKETS_PER_HOST)
+    {
+        num_sockets = MAX_SOCKETS_PER_HOST;
+    }
+
+    // sockets sit on separate APML devices, read them all in parallel
+    std::vector<std::unique_ptr<OneshotCollector>> collectors;
+    std::vector<uint64_t> usec(num_sockets, 0);
+    std::vector<std::thread> threads;
+    ApmlCapabilities caps;
+    for (unsigned int soc_num = 0; soc_num < num_sockets; soc_num++)
+    {
+        collectors.emplace_back(std::make_unique<OneshotCollector>(0, config));
+        collectors.back()->set_capabilities(&caps);
+        collectors.back()->set_backend(apml);
+    }
+    for (unsigned int soc_num = 0; soc_num < num_sockets; soc_num++)
+    {
+        threads.emplace_back([&, soc_num]() {
+            auto start = std::chrono::steady_clock::now();
+            collectors[soc_num]->collect_socket(soc_num);
+            usec[soc_num] = std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() - start).count();
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (!json)
+    {
+        for (unsigned int soc_num = 0; soc_num < num_sockets; soc_num++)
+        {
+            print_socket_text(soc_num, *collectors[soc_num], usec[soc_num]);
+        }
+        printf("total: %llu us\n",
+               (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - begin).count());
+        fflush(stdout);
+        return 0;
+    }
+
+    printf("{\n  \"sockets\": [");
+    for (unsigned int soc_num = 0; soc_num < num_sockets; soc_num++)
+    {
+        printf("%s\n", soc_num ? "," : "");
+        print_socket(soc_num, *collectors[soc_num], usec[soc_num]);
+    }
+    printf("\n  ],\n  \"total_usec\": %llu\n}\n",
+           (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - begin).count());
+    fflush(stdout);
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "service_notify.hpp"
+
+#include <systemd/sd-daemon.h>
+#include <systemd/sd-journal.h>
+
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+
+#define STATUS_LEN   (256)
+
+ServiceNotifier::ServiceNotifier(sd_event *event, unsigned int num_of_hosts) :
+    hosts(num_of_hosts)
+{
+    if (sd_watchdog_enabled(0, &watchdog_usec) <= 0)
+    {
+        watchdog_usec = 0;
+        return;
+    }
+
+    // keep-alive at half the configured WatchdogSec
+    uint64_t now;
+    sd_event_now(event, CLOCK_MONOTONIC, &now);
+    int ret = sd_event_add_time(event, &watchdog_source, CLOCK_MONOTONIC,
+                                now + watchdog_usec / 2, 0, on_watchdog, this);
+    if (ret < 0)
+    {
+        sd_journal_print(LOG_ERR, "Failed to arm the watchdog timer : %d \n", ret);
+    }
+}
+
+ServiceNotifier::~ServiceNotifier()
+{
+    sd_event_source_unref(watchdog_source);
+}
+
+void ServiceNotifier::host_ready(unsigned int host_num, const char *reason)
+{
+    if (host_num >= hosts.size() || hosts[host_num].ready)
+    {
+        return;
+    }
+    hosts[host_num].ready = true;
+    status("host%u ready: %s", host_num, reason);
+
+    for (const auto& host : hosts)
+    {
+        if (!host.ready)
+            return;
+    }
+    if (!notified_ready)
+    {
+        notified_ready = true;
+        sd_notify(0, "READY=1\nSTATUS=Inventory published");
+    }
+}
+
+void ServiceNotifier::collection_started(unsigned int host_num)
+{
+    if (host_num >= hosts.size())
+        return;
+    hosts[host_num].collecting = true;
+    hosts[host_num].started = std::chrono::steady_clock::now();
+}
+
+void ServiceNotifier::collection_done(unsigned int host_num)
+{
+    if (host_num >= hosts.size())
+        return;
+    hosts[host_num].collecting = false;
+}
+
+void ServiceNotifier::status(const char *fmt, ...)
+{
+    char buf[STATUS_LEN];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    sd_notifyf(0, "STATUS=%s", buf);
+}
+
+int ServiceNotifier::on_watchdog(sd_event_source *source, uint64_t usec, void *userdata)
+{
+    ServiceNotifier *self = static_cast<ServiceNotifier *>(userdata);
+    auto now = std::chrono::steady_clock::now();
+
+    // a collection stuck in libapml starves the keep-alive, systemd then
+    // restarts the service instead of it hanging silently. Evaluated on
+    // every tick, a collection that comes back resumes the keep-alive.
+    bool stalled = false;
+    for (unsigned int host_num = 0; host_num < self->hosts.size(); host_num++)
+    {
+        const Host& host = self->hosts[host_num];
+        if (host.collecting && now - host.started > std::chrono::seconds(COLLECTION_TIMEOUT_SEC))
+        {
+            if (!self->stalled)
+            {
+                sd_journal_print(LOG_ERR, "host%u collection stuck for over %d s, stopping watchdog \n",
+                                 host_num, COLLECTION_TIMEOUT_SEC);
+            }
+            stalled = true;
+            break;
+        }
+    }
+    if (self->stalled && !stalled)
+    {
+        sd_journal_print(LOG_INFO, "collection no longer stuck, resuming watchdog \n");
+    }
+    self->stalled = stalled;
+    if (!stalled)
+    {
+        sd_notify(0, "WATCHDOG=1");
+    }
+
+    sd_event_source_set_time(source, usec + self->watchdog_usec / 2);
+    sd_event_source_set_enabled(source, SD_EVENT_ONESHOT);
+    return 0;
+}
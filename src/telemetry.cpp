@@ -0,0 +1,198 @@
+#include "telemetry.hpp"
+
+#include <systemd/sd-journal.h>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+#define BOOST_LIMIT_CPU   (0)
+
+static uint64_t now_usec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+TelemetrySampler::TelemetrySampler(uint32_t period_ms, ApmlBackend *apml,
+                                   SummaryHandler on_summary) :
+    base_period_ms(period_ms ? period_ms : TELEMETRY_PERIOD_MS),
+    period_ms(base_period_ms), apml(apml), on_summary(std::move(on_summary))
+{
+    thread = std::thread(&TelemetrySampler::sampler_main, this);
+}
+
+TelemetrySampler::~TelemetrySampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(stop_lock);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+}
+
+void TelemetrySampler::set_active(uint8_t soc_num, bool active, uint8_t apml_socket)
+{
+    if (soc_num >= TELEMETRY_MAX_SOCKETS)
+        return;
+    if (active)
+    {
+        if (!sockets[soc_num])
+            sockets[soc_num] = std::make_unique<Socket>();
+        sockets[soc_num]->apml_socket = apml_socket;
+        active_mask.fetch_or(1u << soc_num, std::memory_order_release);
+    }
+    else
+    {
+        active_mask.fetch_and(~(1u << soc_num), std::memory_order_release);
+    }
+}
+
+void TelemetrySampler::bus_busy(bool busy)
+{
+    busy_count.fetch_add(busy ? 1 : -1, std::memory_order_relaxed);
+}
+
+size_t TelemetrySampler::drain(uint8_t soc_num, TelemetrySample *out, size_t max)
+{
+    if (soc_num >= TELEMETRY_MAX_SOCKETS || !sockets[soc_num])
+        return 0;
+    return sockets[soc_num]->ring.pop(out, max);
+}
+
+// Read one sample of a socket, returns the bus time spent in usec
+uint64_t TelemetrySampler::sample(Socket& socket, bool read_limits, bool& failed)
+{
+    TelemetrySample& s = socket.last;
+    uint64_t begin = now_usec();
+    float temp;
+
+    s.valid &= (TELEMETRY_POWER_LIMIT_VALID | TELEMETRY_BOOST_VALID);
+    if (apml->socket_power(socket.apml_socket, &s.power_mw) == OOB_SUCCESS)
+        s.valid |= TELEMETRY_POWER_VALID;
+    if (apml->cpu_temp(socket.apml_socket, &temp) == OOB_SUCCESS)
+    {
+        s.temp_mdegc = (int32_t)(temp * 1000);
+        s.valid |= TELEMETRY_TEMP_VALID;
+    }
+    if (read_limits)
+    {
+        s.valid &= ~(TELEMETRY_POWER_LIMIT_VALID | TELEMETRY_BOOST_VALID);
+        if (apml->socket_power_limit(socket.apml_socket, &s.power_limit_mw) == OOB_SUCCESS)
+            s.valid |= TELEMETRY_POWER_LIMIT_VALID;
+        if (apml->boost_limit(socket.apml_socket, BOOST_LIMIT_CPU, &s.boost_limit_mhz) == OOB_SUCCESS)
+            s.valid |= TELEMETRY_BOOST_VALID;
+    }
+    s.usec = now_usec();
+    if (!(s.valid & (TELEMETRY_POWER_VALID | TELEMETRY_TEMP_VALID)))
+        failed = true;
+
+    if (!socket.ring.push(s))
+        socket.dropped++;
+
+    Window& w = socket.window;
+    if (s.valid & TELEMETRY_POWER_VALID)
+    {
+        w.samples++;
+        w.power_sum += s.power_mw;
+        w.power_min = std::min(w.power_min, s.power_mw);
+        w.power_max = std::max(w.power_max, s.power_mw);
+    }
+    if (s.valid & TELEMETRY_TEMP_VALID)
+    {
+        w.temp_samples++;
+        w.temp_sum += s.temp_mdegc;
+        w.temp_min = std::min(w.temp_min, s.temp_mdegc);
+        w.temp_max = std::max(w.temp_max, s.temp_mdegc);
+    }
+
+    return s.usec - begin;
+}
+
+void TelemetrySampler::flush_window(uint8_t soc_num, Socket& socket)
+{
+    Window& w = socket.window;
+    TelemetrySummary summary = {};
+
+    summary.soc_num = soc_num;
+    summary.samples = w.samples;
+    if (w.samples)
+    {
+        summary.power_min_mw = w.power_min;
+        summary.power_avg_mw = w.power_sum / w.samples;
+        summary.power_max_mw = w.power_max;
+    }
+    if (w.temp_samples)
+    {
+        summary.temp_min_mdegc = w.temp_min;
+        summary.temp_avg_mdegc = w.temp_sum / w.temp_samples;
+        summary.temp_max_mdegc = w.temp_max;
+    }
+    summary.power_limit_mw = socket.last.power_limit_mw;
+    summary.boost_limit_mhz = socket.last.boost_limit_mhz;
+    summary.period_ms = period_ms;
+    summary.dropped = socket.dropped;
+    w = Window();
+
+    if (on_summary)
+        on_summary(summary);
+}
+
+void TelemetrySampler::sampler_main()
+{
+    uint64_t tick = 0;
+    uint64_t window_start = now_usec();
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(stop_lock);
+            if (stop_cv.wait_for(lock, std::chrono::milliseconds(period_ms),
+                                 [this] { return stopping; }))
+                return;
+        }
+
+        uint32_t mask = active_mask.load(std::memory_order_acquire);
+        if (!mask || busy_count.load(std::memory_order_relaxed) > 0)
+            continue;
+
+        bool read_limits = (tick++ % TELEMETRY_LIMIT_DIVIDER) == 0;
+        uint64_t bus_usec = 0;
+        bool failed = false;
+        for (uint8_t soc_num = 0; soc_num < TELEMETRY_MAX_SOCKETS; soc_num++)
+        {
+            // a collection that started mid round gets the bus right away
+            if (busy_count.load(std::memory_order_relaxed) > 0)
+                break;
+            if (mask & (1u << soc_num))
+                bus_usec += sample(*sockets[soc_num], read_limits, failed);
+        }
+
+        // back off while the bus is loaded or not answering, creep back
+        // to the base rate once it is quiet again
+        uint64_t share = bus_usec * 100 / (period_ms * 1000ull);
+        if ((share > TELEMETRY_MAX_BUS_SHARE || failed) && period_ms < TELEMETRY_MAX_PERIOD_MS)
+        {
+            period_ms = std::min<uint32_t>(period_ms * 2, TELEMETRY_MAX_PERIOD_MS);
+            sd_journal_print(LOG_INFO, "Telemetry bus share %llu%%, period now %u ms \n",
+                             (unsigned long long)share, period_ms);
+        }
+        else if (share < TELEMETRY_MAX_BUS_SHARE / 4 && period_ms > base_period_ms)
+        {
+            period_ms = std::max(base_period_ms, period_ms - period_ms / 4);
+        }
+
+        uint64_t now = now_usec();
+        if (now - window_start >= TELEMETRY_WINDOW_MS * 1000ull)
+        {
+            window_start = now;
+            for (uint8_t soc_num = 0; soc_num < TELEMETRY_MAX_SOCKETS; soc_num++)
+            {
+                if (mask & (1u << soc_num))
+                    flush_window(soc_num, *sockets[soc_num]);
+            }
+        }
+    }
+}
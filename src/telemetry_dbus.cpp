@@ -0,0 +1,136 @@
+#include "telemetry_dbus.hpp"
+
+#include <systemd/sd-journal.h>
+
+#include <cstring>
+
+const sd_bus_vtable TelemetryObject::vtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::property("Samples", "u", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("PowerMin", "u", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("PowerAvg", "u", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("PowerMax", "u", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("TemperatureMin", "i", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("TemperatureAvg", "i", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("TemperatureMax", "i", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("PowerLimit", "u", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("BoostLimit", "u", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("SamplePeriodMs", "u", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::property("Dropped", "t", TelemetryObject::get_property,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::method("Drain", "u", "a(tuuuiu)", TelemetryObject::drain),
+    sdbusplus::vtable::end()};
+
+TelemetryObject::TelemetryObject(sdbusplus::bus::bus &bus, uint8_t soc_num,
+                                 TelemetrySampler &sampler) :
+    soc_num(soc_num), sampler(sampler),
+    path(std::string(DBUS_OBJECT_NAME) + "/P" + std::to_string(soc_num)),
+    intf(bus, path.c_str(), TELEMETRY_INTF, vtable, this)
+{
+}
+
+void TelemetryObject::update(const TelemetrySummary& new_summary)
+{
+    static const char *properties[] = {"Samples", "PowerMin", "PowerAvg", "PowerMax",
+        "TemperatureMin", "TemperatureAvg", "TemperatureMax", "PowerLimit",
+        "BoostLimit", "SamplePeriodMs", "Dropped"};
+
+    summary = new_summary;
+    for (const char *property : properties)
+    {
+        intf.property_changed(property);
+    }
+}
+
+int TelemetryObject::get_property(sd_bus *bus, const char *path, const char *interface,
+                                  const char *property, sd_bus_message *reply,
+                                  void *userdata, sd_bus_error *error)
+{
+    const TelemetrySummary& s = static_cast<TelemetryObject *>(userdata)->summary;
+    static const struct
+    {
+        const char *name;
+        const uint32_t TelemetrySummary::*field;
+    } u32_fields[] = {
+        {"Samples", &TelemetrySummary::samples},
+        {"PowerMin", &TelemetrySummary::power_min_mw},
+        {"PowerAvg", &TelemetrySummary::power_avg_mw},
+        {"PowerMax", &TelemetrySummary::power_max_mw},
+        {"PowerLimit", &TelemetrySummary::power_limit_mw},
+        {"BoostLimit", &TelemetrySummary::boost_limit_mhz},
+        {"SamplePeriodMs", &TelemetrySummary::period_ms},
+    };
+
+    for (const auto& field : u32_fields)
+    {
+        if (!strcmp(property, field.name))
+            return sd_bus_message_append(reply, "u", s.*field.field);
+    }
+    if (!strcmp(property, "TemperatureMin"))
+        return sd_bus_message_append(reply, "i", s.temp_min_mdegc);
+    if (!strcmp(property, "TemperatureAvg"))
+        return sd_bus_message_append(reply, "i", s.temp_avg_mdegc);
+    if (!strcmp(property, "TemperatureMax"))
+        return sd_bus_message_append(reply, "i", s.temp_max_mdegc);
+    return sd_bus_message_append(reply, "t", s.dropped);
+}
+
+// Drain(max) -> a(usec, power mW, power limit mW, boost limit MHz, temp m°C, valid)
+int TelemetryObject::drain(sd_bus_message *msg, void *userdata, sd_bus_error *error)
+{
+    TelemetryObject *self = static_cast<TelemetryObject *>(userdata);
+    TelemetrySample samples[TELEMETRY_DRAIN_MAX];
+    sd_bus_message *reply = nullptr;
+    uint32_t max = 0;
+
+    int ret = sd_bus_message_read(msg, "u", &max);
+    if (ret < 0)
+        return ret;
+    if (max == 0 || max > TELEMETRY_DRAIN_MAX)
+        max = TELEMETRY_DRAIN_MAX;
+
+    size_t count = self->sampler.drain(self->soc_num, samples, max);
+
+    ret = sd_bus_message_new_method_return(msg, &reply);
+    if (ret < 0)
+        return ret;
+    ret = sd_bus_message_open_container(reply, 'a', "(tuuuiu)");
+    for (size_t i = 0; ret >= 0 && i < count; i++)
+    {
+        const TelemetrySample& s = samples[i];
+        ret = sd_bus_message_append(reply, "(tuuuiu)", s.usec, s.power_mw, s.power_limit_mw,
+                                    s.boost_limit_mhz, s.temp_mdegc, s.valid);
+    }
+    if (ret >= 0)
+        ret = sd_bus_message_close_container(reply);
+    if (ret >= 0)
+        ret = sd_bus_send(nullptr, reply, nullptr);
+    sd_bus_message_unref(reply);
+    return ret < 0 ? ret : 1;
+}
+
+TelemetryService::TelemetryService(sdbusplus::bus::bus &bus, WorkerPool &pool, uint32_t period_ms,
+                                   ApmlBackend *apml) :
+    bus(bus), pool(pool),
+    sampler(period_ms, apml, [this](const TelemetrySummary& summary) {
+        this->pool.post_to_loop([this, summary]() {
+            auto& object = objects[summary.soc_num];
+            if (!object)
+            {
+                object = std::make_unique<TelemetryObject>(this->bus, summary.soc_num, sampler);
+            }
+            object->update(summary);
+        });
+    })
+{
+}
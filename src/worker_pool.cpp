@@ -0,0 +1,274 @@
+#include "worker_pool.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <systemd/sd-journal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+static std::atomic<uint64_t> next_generation{1};
+// links between the thread caches and the pools, taken on registration,
+// pool destruction and thread exit, never on a cache hit
+static std::mutex cache_lock;
+
+static uint64_t waited_usec(std::chrono::steady_clock::time_point queued)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - queued).count();
+}
+
+WorkerPool::WorkerPool(sd_event *event, unsigned int threads) :
+    generation(next_generation.fetch_add(1, std::memory_order_relaxed))
+{
+    loop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop_fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "eventfd");
+    }
+    int ret = sd_event_add_io(event, &loop_source, loop_fd, EPOLLIN, on_loop_event, this);
+    if (ret < 0)
+    {
+        close(loop_fd);
+        throw std::system_error(-ret, std::generic_category(), "sd_event_add_io");
+    }
+
+    if (threads == 0)
+        threads = 1;
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        auto worker = std::make_unique<Worker>();
+        // blocking, the worker sleeps in read() while its queue is empty
+        worker->wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (worker->wake_fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "eventfd");
+        }
+        workers.push_back(std::move(worker));
+    }
+    for (auto& worker : workers)
+    {
+        worker->thread = std::thread(&WorkerPool::worker_main, this, std::ref(*worker));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    stopping = true;
+    for (auto& worker : workers)
+    {
+        wake(worker->wake_fd);
+    }
+    for (auto& worker : workers)
+    {
+        worker->thread.join();
+        close(worker->wake_fd);
+    }
+    sd_event_source_unref(loop_source);
+    close(loop_fd);
+
+    // free the entries of the threads that posted here for later pools
+    std::lock_guard<std::mutex> lock(cache_lock);
+    for (CacheEntry *entry : producer_entries)
+    {
+        if (entry)
+        {
+            entry->generation.store(0, std::memory_order_relaxed);
+            entry->pool = nullptr;
+        }
+    }
+}
+
+WorkerPool::ThreadCache::~ThreadCache()
+{
+    std::lock_guard<std::mutex> lock(cache_lock);
+    for (auto& entry : entries)
+    {
+        if (entry.generation.load(std::memory_order_relaxed))
+        {
+            entry.pool->producer_entries[entry.producer] = nullptr;
+        }
+    }
+}
+
+void WorkerPool::wake(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0)
+    {
+        sd_journal_print(LOG_ERR, "Failed to signal eventfd %d : %d \n", fd, errno);
+    }
+}
+
+// Queues are sized far above what the hosts can have outstanding, a full
+// one means the consumer is stuck and waiting is the only safe choice
+void WorkerPool::push_task(TaskQueue& queue, Task&& task)
+{
+    bool logged = false;
+    while (!queue.push(std::move(task)))
+    {
+        if (!logged)
+        {
+            logged = true;
+            sd_journal_print(LOG_ERR, "Worker queue full, waiting for the consumer \n");
+        }
+        std::this_thread::yield();
+    }
+}
+
+void WorkerPool::post(std::function<void()> job, unsigned int lane)
+{
+    Worker& worker = *workers[lane % workers.size()];
+
+    push_task(worker.jobs, Task{std::move(job), std::chrono::steady_clock::now()});
+    loop_stats.job_depth_max = std::max<uint32_t>(loop_stats.job_depth_max, worker.jobs.size());
+    wake(worker.wake_fd);
+}
+
+// The completion queue of the calling thread, registered on first use
+WorkerPool::TaskQueue& WorkerPool::loop_queue()
+{
+    thread_local ThreadCache cache;
+    static std::atomic<bool> cache_full_logged{false};
+
+    for (auto& entry : cache.entries)
+    {
+        if (entry.generation.load(std::memory_order_relaxed) == generation)
+            return *entry.queue;
+    }
+
+    std::lock_guard<std::mutex> cache_guard(cache_lock);
+    auto free_entry = std::find_if(std::begin(cache.entries), std::end(cache.entries),
+                                   [](const CacheEntry& entry) {
+                                       return entry.generation.load(std::memory_order_relaxed) == 0;
+                                   });
+    // registering a queue that cannot be cached would take a new producer
+    // slot on every post
+    if (free_entry == std::end(cache.entries))
+    {
+        if (!cache_full_logged.exchange(true))
+        {
+            sd_journal_print(LOG_ERR, "Thread posts to more than %d pools, completions dropped \n",
+                             THREAD_POOLS_MAX);
+        }
+        throw std::runtime_error("too many pools posted to from one thread");
+    }
+
+    std::lock_guard<std::mutex> lock(producers_lock);
+    unsigned int index = num_producers.load(std::memory_order_relaxed);
+    if (index == LOOP_PRODUCERS_MAX)
+    {
+        throw std::runtime_error("too many threads posting to the event loop");
+    }
+    producers[index] = std::make_unique<TaskQueue>();
+    num_producers.store(index + 1, std::memory_order_release);
+    free_entry->queue = producers[index].get();
+    free_entry->pool = this;
+    free_entry->producer = index;
+    free_entry->generation.store(generation, std::memory_order_relaxed);
+    producer_entries[index] = &*free_entry;
+    return *producers[index];
+}
+
+void WorkerPool::post_to_loop(std::function<void()> fn)
+{
+    push_task(loop_queue(), Task{std::move(fn), std::chrono::steady_clock::now()});
+    wake(loop_fd);
+}
+
+void WorkerPool::worker_main(Worker& worker)
+{
+    while (!stopping)
+    {
+        Task task;
+        if (!worker.jobs.pop(task))
+        {
+            // the counter stays set for a job pushed before this read
+            uint64_t count;
+            if (read(worker.wake_fd, &count, sizeof(count)) < 0 && errno != EINTR)
+            {
+                sd_journal_print(LOG_ERR, "Failed to read the worker eventfd : %d \n", errno);
+            }
+            continue;
+        }
+
+        uint64_t wait = waited_usec(task.queued);
+        worker.runs.fetch_add(1, std::memory_order_relaxed);
+        worker.wait_total_usec.fetch_add(wait, std::memory_order_relaxed);
+        if (wait > worker.wait_max_usec.load(std::memory_order_relaxed))
+            worker.wait_max_usec.store(wait, std::memory_order_relaxed);
+        try
+        {
+            task.fn();
+        }
+        catch (std::exception& e)
+        {
+            sd_journal_print(LOG_ERR, "Exception in worker job : %s \n", e.what());
+        }
+    }
+}
+
+int WorkerPool::on_loop_event(sd_event_source *source, int fd, uint32_t revents, void *userdata)
+{
+    WorkerPool *pool = static_cast<WorkerPool *>(userdata);
+    WorkerPoolStats& stats = pool->loop_stats;
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        sd_journal_print(LOG_ERR, "Failed to read the loop eventfd : %d \n", errno);
+    }
+
+    unsigned int producers = pool->num_producers.load(std::memory_order_acquire);
+    for (unsigned int i = 0; i < producers; i++)
+    {
+        TaskQueue& queue = *pool->producers[i];
+        Task task;
+
+        stats.completion_depth_max = std::max<uint32_t>(stats.completion_depth_max, queue.size());
+        while (queue.pop(task))
+        {
+            uint64_t wait = waited_usec(task.queued);
+            stats.completions++;
+            stats.completion_wait_total_usec += wait;
+            stats.completion_wait_max_usec = std::max(stats.completion_wait_max_usec, wait);
+            try
+            {
+                task.fn();
+            }
+            catch (std::exception& e)
+            {
+                sd_journal_print(LOG_ERR, "Exception in loop completion : %s \n", e.what());
+            }
+        }
+    }
+    return 0;
+}
+
+WorkerPoolStats WorkerPool::stats() const
+{
+    WorkerPoolStats stats = loop_stats;
+
+    for (const auto& worker : workers)
+    {
+        stats.jobs += worker->runs.load(std::memory_order_relaxed);
+        stats.job_wait_total_usec += worker->wait_total_usec.load(std::memory_order_relaxed);
+        stats.job_wait_max_usec = std::max(stats.job_wait_max_usec,
+                                           worker->wait_max_usec.load(std::memory_order_relaxed));
+    }
+    return stats;
+}
+
+void WorkerPool::reset_stats()
+{
+    loop_stats = {};
+    for (auto& worker : workers)
+    {
+        worker->runs = 0;
+        worker->wait_total_usec = 0;
+        worker->wait_max_usec = 0;
+    }
+}
@@ -0,0 +1,127 @@
+// The collection path does not touch the heap once warmed up: counts the
+// operator new calls of collect_socket with APML replayed from a trace
+// and the presence GPIOs read through libgpiod, and with --publish of CpuInfo::publish up to the last Set reply (run on
+// a private bus by with_bus.sh). Fails on any allocation.
+
+#include "cpu_info_test.hpp"
+
+#include <getopt.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#define ALLOC_ROUNDS  (100)
+
+static std::atomic<unsigned long> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+// allocations of rounds calls of fn after a first warm-up call
+template <typename Fn>
+static bool check(const char *name, Fn&& fn)
+{
+    fn();
+    unsigned long before = allocations.load();
+    for (int round = 0; round < ALLOC_ROUNDS; round++)
+    {
+        fn();
+    }
+    unsigned long count = allocations.load() - before;
+    printf("%s: %lu allocations in %d rounds\n", name, count, ALLOC_ROUNDS);
+    return count == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = nullptr;
+    bool publish = false;
+
+    static const struct option long_options[] = {
+        {"trace", required_argument, nullptr, 't'},
+        {"publish", no_argument, nullptr, 'p'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'p':
+                publish = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s --trace FILE [--publish]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (!trace_path)
+    {
+        fprintf(stderr, "Usage: %s --trace FILE [--publish]\n", argv[0]);
+        return -1;
+    }
+
+    ReplayBackend replay(trace_path, 0);
+    if (!replay.is_open())
+    {
+        return -1;
+    }
+    CpuCollector collector;
+    collector.set_backend(&replay);
+    // cleared as the collection job of CpuInfo does
+    bool ok = check("collect_socket", [&]() {
+        collector.pending.clear();
+        collector.timings.clear();
+        collector.present.clear();
+        for (uint8_t soc_num = 0; soc_num < MAX_SOCKETS_PER_HOST; soc_num++)
+        {
+            collector.collect_socket(soc_num);
+        }
+    });
+
+    if (publish)
+    {
+        sd_event *event = nullptr;
+        if (sd_event_default(&event) < 0)
+        {
+            fprintf(stderr, "Failed to create an event loop \n");
+            return -1;
+        }
+        auto bus = sdbusplus::bus::new_default();
+        bus.attach_event(event, SD_EVENT_PRIORITY_NORMAL);
+        {
+            CpuShmWriter snapshot;
+            WorkerPool pool{event, 1};
+            CpuInfoServices services{pool, snapshot};
+            services.apml = &replay;
+            CpuInfo info(bus, 0, default_host_config(0), services);
+            ok = check("publish", [&]() {
+                CpuInfoTest::publish(info, event, collector.pending);
+            }) && ok;
+        }
+        sd_event_unref(event);
+    }
+    return ok ? 0 : 1;
+}
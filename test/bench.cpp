@@ -0,0 +1,134 @@
+// Micro benchmarks of the collection path, one JSON object per line:
+// the PPIN and OPN decoders, property staging by collect_socket with APML
+// replayed from a trace, and CpuInfo::publish up to the last Set reply.
+// The publish benchmark needs an Inventory Manager, make bench runs it on
+// a private bus with fake-host (with_bus.sh).
+
+#include "cpu_decode.hpp"
+#include "cpu_info_test.hpp"
+
+#include <getopt.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#define DECODE_ITERATIONS   (1000000)
+#define STAGE_ITERATIONS    (10000)
+#define PUBLISH_ITERATIONS  (200)
+
+// keeps the decoder output alive
+static volatile char sink;
+
+template <typename Fn>
+static void run(const char *name, unsigned int iterations, unsigned int ops, Fn&& fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        fn(i);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() -
+                                                         start).count();
+    printf("{\"bench\": \"%s\", \"iterations\": %u, \"ops\": %u, \"ns_per_iteration\": %.1f}\n",
+           name, iterations, ops, ns / iterations);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s --trace FILE [--publish]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = nullptr;
+    bool publish = false;
+
+    static const struct option long_options[] = {
+        {"trace", required_argument, nullptr, 't'},
+        {"publish", no_argument, nullptr, 'p'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'p':
+                publish = true;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (!trace_path)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    char buf[OPN_BUFF_LEN];
+    run("decode_ppin_serial", DECODE_ITERATIONS, 1, [&](unsigned int i) {
+        decode_ppin_serial(0x02b3c4d5e6f70819ULL + i, buf, sizeof(buf));
+        sink = buf[0];
+    });
+    uint32_t regs[OPN_LEAF_COUNT][OPN_REG_COUNT] = {
+        {0x20444d41, 0x43595045, 0x3439205f, 0x2d203435},
+        {0x726f4320, 0x72502065, 0x7365636f, 0x20726f73},
+        {0x20202020, 0x20202020, 0x20202020, 0x00202020}};
+    run("decode_opn", DECODE_ITERATIONS, 1, [&](unsigned int i) {
+        regs[0][0] = 0x20444d41 + (i & 1);
+        decode_opn(regs, buf);
+        sink = buf[0];
+    });
+
+    // answers repeat once the trace runs out, the retries of the first
+    // collection are not replayed by the later ones
+    ReplayBackend replay(trace_path, 0);
+    if (!replay.is_open())
+    {
+        return -1;
+    }
+    CpuCollector collector;
+    collector.set_backend(&replay);
+    auto stage = [&](unsigned int) {
+        collector.pending.clear();
+        collector.timings.clear();
+        collector.present.clear();
+        for (uint8_t soc_num = 0; soc_num < MAX_SOCKETS_PER_HOST; soc_num++)
+        {
+            collector.collect_socket(soc_num);
+        }
+    };
+    stage(0);
+    run("collect_socket", STAGE_ITERATIONS, collector.pending.size(), stage);
+
+    if (!publish)
+    {
+        return 0;
+    }
+    sd_event *event = nullptr;
+    if (sd_event_default(&event) < 0)
+    {
+        fprintf(stderr, "Failed to create an event loop \n");
+        return -1;
+    }
+    auto bus = sdbusplus::bus::new_default();
+    bus.attach_event(event, SD_EVENT_PRIORITY_NORMAL);
+    {
+        CpuShmWriter snapshot;
+        WorkerPool pool{event, 1};
+        CpuInfoServices services{pool, snapshot};
+        services.apml = &replay;
+        CpuInfo info(bus, 0, default_host_config(0), services);
+        const std::vector<PendingProperty>& props = collector.pending;
+        run("publish", PUBLISH_ITERATIONS, props.size(), [&](unsigned int) {
+            CpuInfoTest::publish(info, event, props);
+        });
+    }
+    sd_event_unref(event);
+    return 0;
+}
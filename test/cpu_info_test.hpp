@@ -0,0 +1,18 @@
+#pragma once
+
+#include "cpu_info.hpp"
+
+// Drives the private parts of CpuInfo for the bench and the tests
+class CpuInfoTest
+{
+  public:
+    // queue the Sets of props and dispatch until every one was answered
+    static void publish(CpuInfo& info, sd_event *event, const std::vector<PendingProperty>& props)
+    {
+        info.publish(props);
+        while (info.outstanding_sets != 0)
+        {
+            sd_event_run(event, UINT64_MAX);
+        }
+    }
+};
@@ -0,0 +1,192 @@
+// Stands in for the host state manager of host0 and the Inventory
+// Manager, so that cpu-info runs on a private bus. CurrentHostState is
+// writable, a Set emits PropertiesChanged like the real service. Every
+// Set sent to the Inventory Manager is answered successfully, after
+// --reply-delay-ms, unless --drop-percent drops it without a reply.
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/server/interface.hpp>
+#include <sdbusplus/vtable.hpp>
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <string>
+
+#define HOST_SERVICE       "xyz.openbmc_project.State.Host0"
+#define HOST_PATH          "/xyz/openbmc_project/state/host0"
+#define HOST_INTF          "xyz.openbmc_project.State.Host"
+#define HOST_OFF           "xyz.openbmc_project.State.Host.HostState.Off"
+#define INVENTORY_SERVICE  "xyz.openbmc_project.Inventory.Manager"
+#define INVENTORY_PATH     "/xyz/openbmc_project/inventory"
+#define PROPERTIES_INTF    "org.freedesktop.DBus.Properties"
+// drops are random but the same from one run to the next
+#define DROP_SEED          (1)
+
+static uint64_t now_usec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+// Set answered once due, replies all have the same delay so they are due
+// in arrival order
+struct DelayedReply
+{
+    uint64_t due_usec;
+    sd_bus_message *msg;
+};
+
+struct FakeHost
+{
+    std::string state = HOST_OFF;
+    sdbusplus::server::interface_t *intf = nullptr;
+    unsigned int delay_ms = 0;
+    unsigned int drop_percent = 0;
+    std::deque<DelayedReply> delayed;
+
+    static int get_state(sd_bus *bus, const char *path, const char *interface,
+                         const char *property, sd_bus_message *reply,
+                         void *userdata, sd_bus_error *error)
+    {
+        FakeHost *self = static_cast<FakeHost *>(userdata);
+        return sd_bus_message_append(reply, "s", self->state.c_str());
+    }
+
+    static int set_state(sd_bus *bus, const char *path, const char *interface,
+                         const char *property, sd_bus_message *value,
+                         void *userdata, sd_bus_error *error)
+    {
+        FakeHost *self = static_cast<FakeHost *>(userdata);
+        const char *state = nullptr;
+        int ret = sd_bus_message_read(value, "s", &state);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        self->state = state;
+        self->intf->property_changed("CurrentHostState");
+        return 1;
+    }
+
+    // any Set on an inventory object succeeds, the rest is not handled
+    static int inventory_call(sd_bus_message *msg, void *userdata, sd_bus_error *error)
+    {
+        FakeHost *self = static_cast<FakeHost *>(userdata);
+        const char *interface = sd_bus_message_get_interface(msg);
+        const char *member = sd_bus_message_get_member(msg);
+
+        if (!interface || !member || strcmp(interface, PROPERTIES_INTF) || strcmp(member, "Set"))
+        {
+            return 0;
+        }
+        // handled, the caller waits for its timeout
+        if (self->drop_percent && (unsigned int)(rand() % 100) < self->drop_percent)
+        {
+            return 1;
+        }
+        if (self->delay_ms)
+        {
+            self->delayed.push_back({now_usec() + self->delay_ms * 1000ull,
+                                     sd_bus_message_ref(msg)});
+            return 1;
+        }
+        return sd_bus_reply_method_return(msg, "");
+    }
+
+    // answers the due Sets, returns the wait until the next one
+    uint64_t reply_due()
+    {
+        uint64_t now = now_usec();
+        while (!delayed.empty() && delayed.front().due_usec <= now)
+        {
+            sd_bus_reply_method_return(delayed.front().msg, "");
+            sd_bus_message_unref(delayed.front().msg);
+            delayed.pop_front();
+        }
+        return delayed.empty() ? UINT64_MAX : delayed.front().due_usec - now;
+    }
+
+    static const sd_bus_vtable vtable[];
+};
+
+const sd_bus_vtable FakeHost::vtable[] = {
+    sdbusplus::vtable::start(),
+    sdbusplus::vtable::property("CurrentHostState", "s", FakeHost::get_state,
+                                FakeHost::set_state,
+                                sdbusplus::vtable::property_::emits_change),
+    sdbusplus::vtable::end()};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--reply-delay-ms MS] [--drop-percent 0-100]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    FakeHost host;
+
+    static const struct option long_options[] = {
+        {"reply-delay-ms", required_argument, nullptr, 'd'},
+        {"drop-percent", required_argument, nullptr, 'p'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    char *end;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                host.delay_ms = strtoul(optarg, &end, 10);
+                break;
+            case 'p':
+                host.drop_percent = strtoul(optarg, &end, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+        if (end == optarg || *end || host.drop_percent > 100)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    srand(DROP_SEED);
+
+    auto bus = sdbusplus::bus::new_default();
+    sdbusplus::server::interface_t intf(bus, HOST_PATH, HOST_INTF, FakeHost::vtable, &host);
+    host.intf = &intf;
+
+    sd_bus_slot *slot = nullptr;
+    int ret = sd_bus_add_fallback(bus.get(), &slot, INVENTORY_PATH, FakeHost::inventory_call,
+                                  &host);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Failed to serve %s : %d \n", INVENTORY_PATH, ret);
+        return -1;
+    }
+    bus.request_name(HOST_SERVICE);
+    bus.request_name(INVENTORY_SERVICE);
+
+    while (true)
+    {
+        ret = sd_bus_process(bus.get(), nullptr);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Failed to process the bus : %d \n", ret);
+            return -1;
+        }
+        uint64_t wait_usec = host.reply_due();
+        if (ret == 0)
+        {
+            sd_bus_wait(bus.get(), wait_usec);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Builds cpu-info with ENABLE_LOW_MEMORY and checks its footprint: the size
+# of the stripped binary, VmHWM once one collection was published on a
+# private bus (see power_storm.sh), and VmRSS after the settle period.
+#
+# usage: footprint.sh SOURCE_DIR BUILD_DIR
+#
+# MAX_SIZE_KIB, MAX_HWM_KIB and MAX_RSS_KIB are the limits. A figure
+# without a limit is only printed, take them from a run on the target
+# build and leave some headroom.
+
+set -eu
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 SOURCE_DIR BUILD_DIR" >&2
+    exit 2
+fi
+src=$(cd "$1" && pwd)
+build=$2
+max_size_kib=${MAX_SIZE_KIB:-}
+max_hwm_kib=${MAX_HWM_KIB:-}
+max_rss_kib=${MAX_RSS_KIB:-}
+
+mkdir -p "$build"
+(cd "$build" && cmake "$src" -DENABLE_LOW_MEMORY=ON -DENABLE_TESTS=ON >/dev/null &&
+    make cpu-info fake-host >/dev/null)
+
+size_kib=$(( ($(stat -c %s "$build/cpu-info") + 1023) / 1024 ))
+echo "SizeKiB $size_kib"
+
+# one power on, the peak since the start of the process, then the
+# resident set once the collection settled
+figures=$(STATS_RESET=0 APML_TIME_SCALE=0 SETTLE_SEC=2 \
+    "$src/test/power_storm.sh" "$build/cpu-info" "$build/test/fake-host" \
+    "$src/test/data/two_socket.trace" 1 3 0)
+hwm_kib=$(echo "$figures" | awk '$1 == "PeakRssKiB" { print $2 }')
+rss_kib=$(echo "$figures" | awk '$1 == "RssKiB" { print $2 }')
+echo "PeakRssKiB $hwm_kib"
+echo "RssKiB $rss_kib"
+
+failed=0
+# check NAME VALUE LIMIT
+check()
+{
+    if [ -z "$3" ]; then
+        echo "$1 has no limit" >&2
+    elif [ -z "$2" ] || [ "$2" -gt "$3" ]; then
+        echo "$1 is ${2:-unknown} KiB, over $3 KiB" >&2
+        failed=1
+    fi
+}
+check SizeKiB "$size_kib" "$max_size_kib"
+check PeakRssKiB "$hwm_kib" "$max_hwm_kib"
+check RssKiB "$rss_kib" "$max_rss_kib"
+exit $failed
@@ -0,0 +1,90 @@
+#!/bin/sh
+# Power cycle storm against a private D-Bus. fake-host serves the state of
+# host0 and the Inventory Manager, cpu-info answers APML from a trace.
+# The ServiceStats figures after the storm, and RssKiB, the VmRSS of
+# cpu-info then, are printed as "name value" lines, the run fails when no collection ran or, unless Sets are
+# dropped, a Set failed.
+#
+# usage: power_storm.sh CPU_INFO FAKE_HOST TRACE [CYCLES] [ON_SEC] [OFF_SEC]
+#
+# APML_TIME_SCALE scales the recorded APML timing, 1 by default. SETTLE_SEC
+# is the wait after the last power off before the figures are read.
+# STATS_RESET=0 keeps the figures from the start of cpu-info, it is needed
+# for a cpu-info built without ENABLE_TESTS, which has no Reset.
+# INVENTORY_DELAY_MS and INVENTORY_DROP_PERCENT slow down and drop the
+# Inventory Manager replies of fake-host, dropped Sets fail after the
+# 25 s D-Bus timeout.
+
+set -eu
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 CPU_INFO FAKE_HOST TRACE [CYCLES] [ON_SEC] [OFF_SEC]" >&2
+    exit 2
+fi
+cpu_info=$1
+fake_host=$2
+trace=$3
+cycles=${4:-20}
+on_sec=${5:-2}
+off_sec=${6:-1}
+time_scale=${APML_TIME_SCALE:-1}
+settle_sec=${SETTLE_SEC:-5}
+stats_reset=${STATS_RESET:-1}
+delay_ms=${INVENTORY_DELAY_MS:-0}
+drop_percent=${INVENTORY_DROP_PERCENT:-0}
+
+CPU_INFO_SERVICE=xyz.openbmc_project.Inventory.Item
+STATS_PATH=/xyz/openbmc_project/inventory/system/processor
+STATS_INTF=xyz.openbmc_project.Inventory.Item.Cpu.ServiceStats
+HOST_SERVICE=xyz.openbmc_project.State.Host0
+HOST_PATH=/xyz/openbmc_project/state/host0
+HOST_INTF=xyz.openbmc_project.State.Host
+HOST_STATE=xyz.openbmc_project.State.Host.HostState
+
+. "$(dirname "$0")/private_bus.sh"
+trap stop_private_bus EXIT INT TERM
+start_private_bus
+
+set_host_state()
+{
+    bus set-property $HOST_SERVICE $HOST_PATH $HOST_INTF CurrentHostState s "$HOST_STATE.$1"
+}
+
+"$fake_host" --reply-delay-ms "$delay_ms" --drop-percent "$drop_percent" &
+pids="$! $pids"
+wait_for_name $HOST_SERVICE
+
+"$cpu_info" --apml-replay "$trace" --apml-time-scale "$time_scale" &
+cpu_info_pid=$!
+pids="$cpu_info_pid $pids"
+wait_for_name $CPU_INFO_SERVICE
+
+if [ "$stats_reset" -ne 0 ]; then
+    bus call $CPU_INFO_SERVICE $STATS_PATH $STATS_INTF Reset
+fi
+cycle=0
+while [ $cycle -lt "$cycles" ]; do
+    set_host_state Running
+    sleep "$on_sec"
+    set_host_state Off
+    sleep "$off_sec"
+    cycle=$((cycle + 1))
+done
+sleep "$settle_sec"
+
+for figure in HostStateSignals Collections CoalescedTriggers SetsIssued SetsFailed \
+              InventorySamples TimeToInventoryP50Usec TimeToInventoryP99Usec PeakRssKiB \
+              Jobs JobQueueDepthMax JobWaitAvgUsec JobWaitMaxUsec Completions \
+              CompletionQueueDepthMax CompletionWaitAvgUsec CompletionWaitMaxUsec; do
+    value=$(bus get-property $CPU_INFO_SERVICE $STATS_PATH $STATS_INTF $figure | cut -d ' ' -f 2)
+    echo "$figure $value" | tee -a "$workdir/stats"
+done
+rss_kib=$(awk '$1 == "VmRSS:" { print $2 }' "/proc/$cpu_info_pid/status")
+echo "RssKiB $rss_kib" | tee -a "$workdir/stats"
+
+collections=$(awk '$1 == "Collections" { print $2 }' "$workdir/stats")
+sets_failed=$(awk '$1 == "SetsFailed" { print $2 }' "$workdir/stats")
+if [ "$collections" -eq 0 ] || { [ "$drop_percent" -eq 0 ] && [ "$sets_failed" -ne 0 ]; }; then
+    echo "storm failed: $collections collections, $sets_failed failed Sets" >&2
+    exit 1
+fi
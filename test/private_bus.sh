@@ -0,0 +1,46 @@
+# Sourced by the test scripts. start_private_bus runs a dbus-daemon of
+# its own and makes it the system bus of every program started after it,
+# stop_private_bus kills it and the pids in $pids.
+
+pids=
+workdir=
+
+start_private_bus()
+{
+    workdir=$(mktemp -d)
+    dbus-daemon --session --fork --print-address=3 --print-pid=4 \
+        3>"$workdir/address" 4>"$workdir/pid"
+    address=$(head -n 1 "$workdir/address")
+    pids=$(head -n 1 "$workdir/pid")
+
+    # sd_bus_default() picks the private bus as system bus
+    export DBUS_SYSTEM_BUS_ADDRESS="$address"
+    export DBUS_STARTER_BUS_TYPE=system
+}
+
+stop_private_bus()
+{
+    for pid in $pids; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$workdir"
+}
+
+bus()
+{
+    busctl --address="$address" "$@"
+}
+
+wait_for_name()
+{
+    tries=50
+    until bus status "$1" >/dev/null 2>&1; do
+        tries=$((tries - 1))
+        if [ $tries -eq 0 ]; then
+            echo "$1 did not appear on the bus" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Runs a command on a private bus, the Inventory Manager Sets answered by
+# fake-host. Exits with the status of the command.
+#
+# usage: with_bus.sh FAKE_HOST COMMAND [ARGS...]
+
+set -eu
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 FAKE_HOST COMMAND [ARGS...]" >&2
+    exit 2
+fi
+
+. "$(dirname "$0")/private_bus.sh"
+trap stop_private_bus EXIT INT TERM
+start_private_bus
+
+"$1" &
+pids="$! $pids"
+wait_for_name xyz.openbmc_project.Inventory.Manager
+
+shift
+"$@"